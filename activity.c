@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "activity.h"
+
+/* client socket (opened on the first report) */
+static int client_fd = -1;
+
+/**
+ *	activity_addr - get activity reporting socket address
+ *	@sa: returned socket address
+ *
+ *	Returns length of the ACTIVITY_SOCKET_NAME abstract socket
+ *	address.
+ */
+static socklen_t activity_addr(struct sockaddr_un *sa)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	memcpy(sa->sun_path + 1, ACTIVITY_SOCKET_NAME,
+	       sizeof(ACTIVITY_SOCKET_NAME) - 1);
+
+	return offsetof(struct sockaddr_un, sun_path) +
+	       sizeof(ACTIVITY_SOCKET_NAME);
+}
+
+/**
+ *	activity_report_many - report activity of tasks
+ *	@msgs: activity messages
+ *	@nr: number of messages (at most ACTIVITY_MAX_MSGS)
+ *
+ *	Sends @msgs to proxy_shm in a single datagram.  Returns 0 on
+ *	success or errno value on failure (i.e. ECONNREFUSED if
+ *	proxy_shm is not running).
+ */
+int activity_report_many(const struct activity_msg *msgs, int nr)
+{
+	struct sockaddr_un sa;
+	socklen_t len = activity_addr(&sa);
+
+	if (nr <= 0 || nr > ACTIVITY_MAX_MSGS)
+		return EINVAL;
+
+	if (client_fd < 0) {
+		client_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (client_fd < 0)
+			return errno;
+	}
+
+	if (sendto(client_fd, msgs, nr * sizeof(*msgs), 0,
+		   (struct sockaddr *)&sa, len) < 0)
+		return errno;
+
+	return 0;
+}
+
+/**
+ *	activity_report - report activity of a task
+ *	@pid: task PID number
+ *	@activity: 1 for foreground, 0 for background task
+ *
+ *	See activity_report_many().
+ */
+int activity_report(pid_t pid, int activity)
+{
+	struct activity_msg msg = { .pid = pid, .activity = activity };
+
+	return activity_report_many(&msg, 1);
+}
+
+/**
+ *	activity_open - open activity reporting socket
+ *
+ *	Binds the ACTIVITY_SOCKET_NAME socket (with sender credentials
+ *	passing enabled).  Returns non-blocking socket file descriptor
+ *	or -1 on failure.
+ */
+int activity_open(void)
+{
+	struct sockaddr_un sa;
+	socklen_t len = activity_addr(&sa);
+	int on = 1;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) ||
+	    bind(fd, (struct sockaddr *)&sa, len)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ *	task_owned - check whether task may be reported by a user
+ *	@pid: task PID number
+ *	@uid: reporting user ID
+ */
+static int task_owned(pid_t pid, uid_t uid)
+{
+	char path[32];
+	struct stat st;
+
+	if (!uid)
+		return 1;
+
+	sprintf(path, "/proc/%d", pid);
+	if (stat(path, &st))
+		return 0;
+
+	return st.st_uid == uid;
+}
+
+/**
+ *	activity_recv - receive activity report
+ *	@fd: socket opened by activity_open()
+ *	@msgs: returned messages (ACTIVITY_MAX_MSGS entries)
+ *
+ *	Receives a single datagram and stores its messages in @msgs,
+ *	dropping the ones about tasks the sender doesn't own.  Returns
+ *	the number of messages stored or -1 if there is no pending
+ *	datagram (or on error, errno is set then).
+ */
+int activity_recv(int fd, struct activity_msg *msgs)
+{
+	char cbuf[CMSG_SPACE(sizeof(struct ucred))];
+	struct iovec iov = {
+		.iov_base = msgs,
+		.iov_len = ACTIVITY_MAX_MSGS * sizeof(*msgs),
+	};
+	struct msghdr mh = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+	struct ucred *cred = NULL;
+	ssize_t sz;
+	int nr, i, j;
+
+	do {
+		sz = recvmsg(fd, &mh, MSG_DONTWAIT);
+	} while (sz < 0 && errno == EINTR);
+	if (sz < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_CREDENTIALS)
+			cred = (struct ucred *)CMSG_DATA(cmsg);
+
+	if (!cred)
+		return 0;
+
+	nr = sz / sizeof(*msgs);
+	for (i = j = 0; i < nr; i++)
+		if (msgs[i].pid > 0 && task_owned(msgs[i].pid, cred->uid))
+			msgs[j++] = msgs[i];
+
+	return j;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_ACTIVITY_H
+#define __TBULMKD_ACTIVITY_H
+
+#include <sys/types.h>
+
+/*
+ * Task activity reporting API.  Window managers, app launchers etc.
+ * report foreground/background transitions of tasks to proxy_shm
+ * through the ACTIVITY_SOCKET_NAME abstract unix datagram socket
+ * (an alternative to /proc/$pid/activity files added by the kernel
+ * patch).  Each datagram holds one or more struct activity_msg.
+ * Only root or the owner of a task may report its activity.
+ */
+#define ACTIVITY_SOCKET_NAME	"tbulmkd_activity"
+
+/* maximum number of messages in a single datagram */
+#define ACTIVITY_MAX_MSGS	64
+
+struct activity_msg {
+	pid_t pid;
+	int activity; /* 1 == foreground, 0 == background */
+};
+
+/* client side */
+int activity_report(pid_t pid, int activity);
+int activity_report_many(const struct activity_msg *msgs, int nr);
+
+/* proxy_shm side */
+int activity_open(void);
+int activity_recv(int fd, struct activity_msg *msgs);
+
+#endif
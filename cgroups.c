@@ -18,36 +18,56 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/eventfd.h>
+#include <limits.h>
 #include <string.h>
 #include <poll.h>
 #include "tbulmkd.h"
+#include "cgroups.h"
 #include "common.h"
 
+/* memory controller backend (set by init_cgroups()) */
+static struct cgroup_ops *cg_ops;
+
+/*
+ * Per-class cgroup state: cgroup.procs file descriptor (kept open) and
+ * cached cgroup membership (see set_cgroup_member()).
+ */
+struct cg_state {
+	int procs_fd;
+	unsigned long *members;
+	unsigned int members_bits;
+	int members_valid;
+};
+
+static struct cg_state *cg_state;
+
 /**
  *	free_cgroups - free cgroups resources
  *
- *	Removes sysfs memory cgroups (apps & daemons), then
- *	unmounts/removes cgroups memory controller subsystem and
- *	finally unmounts cgroups subsystem itself.
+ *	Closes cgroup.procs files and frees memory controller backend
+ *	resources (per-class memory cgroups).
  */
 void free_cgroups(void)
 {
-	rmdir("/sys/fs/cgroup/memory/apps");
-	rmdir("/sys/fs/cgroup/memory/daemons");
-	umount("/sys/fs/cgroup/memory");
-	rmdir("/sys/fs/cgroup/memory");
-	umount("/sys/fs/cgroup");
+	int i;
+
+	for (i = 0; i < nr_classes; i++) {
+		if (cg_state[i].procs_fd >= 0)
+			close(cg_state[i].procs_fd);
+		cg_state[i].procs_fd = -1;
+	}
+
+	cg_ops->free();
 }
 
 /**
  *	init_cgroups - init cgroups resources
+ *	@version: cgroups version (1 or 2, 0 to detect it)
  *
- *	Mounts cgroups subsystem and creates/mounts cgroups memory
- *	controller subsystem.  Then creates sysfs memory cgroups
- *	(apps & daemons) and sets their memory limits (80% of total
- *	memory by default for each cgroup).  Finally, it disables
- *	the in-kernel OOM killer.
+ *	Selects memory controller backend (cgroups v2 is used if the
+ *	unified hierarchy with memory controller is available when
+ *	@version is 0) and makes it create memory cgroups for all
+ *	classes with memory limits (classes[].percent of total memory).
  *
  *	It depends on availability of /proc pseudo-filesystem for
  *	getting the total memory amount in the system.
@@ -58,13 +78,26 @@ void free_cgroups(void)
  *	TODO: try to discover whether cgroups resources are already
  *	available
  */
-void init_cgroups(void)
+void init_cgroups(int version)
 {
 	FILE *f;
 	char buf[4096];
 	unsigned long int memtotal;
+	unsigned long *limits;
 	int i;
-	float t;
+
+	if (version == 1)
+		cg_ops = &cgroup_v1_ops;
+	else if (version == 2 || cgroup_v2_ops.probe())
+		cg_ops = &cgroup_v2_ops;
+	else
+		cg_ops = &cgroup_v1_ops;
+
+	if (!cg_ops->probe())
+		pabort("cgroups memory controller not available");
+
+	print_timestamp();
+	printf("using cgroups %s memory controller\n", cg_ops->name);
 
 	f = fopen("/proc/meminfo", "r");
 	if (!f)
@@ -87,341 +120,255 @@ void init_cgroups(void)
 	if (DEBUG)
 		printf("memtotal: %lu\n", memtotal);
 
-	free_cgroups();
-
-	/* mount -t tmpfs none /sys/fs/cgroup */
-	if (mount(NULL, "/sys/fs/cgroup", "tmpfs", 0, NULL))
-		pabort("mount /sys/fs/cgroup");
+	cg_state = calloc(nr_classes, sizeof(*cg_state));
+	limits = calloc(nr_classes, sizeof(*limits));
+	if (!cg_state || !limits)
+		pabort("calloc cgroups");
 
-	/* mkdir /sys/fs/cgroup/memory */
-	if (mkdir("/sys/fs/cgroup/memory", 755))
-		pabort("mkdir /sys/fs/cgroup/memory");
-
-	/* mount -t cgroup none /sys/fs/cgroup/memory -o memory */
-	if (mount(NULL, "/sys/fs/cgroup/memory", "cgroup", 0, "memory"))
-		pabort("mount /sys/fs/cgroup/memory");
-
-	/* mkdir /sys/fs/cgroup/memory/daemons */
-	mkdir("/sys/fs/cgroup/memory/daemons", 755);
-//		pabort("mkdir /sys/fs/cgroup/memory/daemons");
-
-	/* echo 80%*MemTotal > /sys/fs/cgroup/memory/daemons/memory.limit_in_bytes */
-	f = fopen("/sys/fs/cgroup/memory/daemons/memory.limit_in_bytes", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/daemons/memory.limit_in_bytes");
-
-	t = (float)daemons_mem_percent / 100 * memtotal;
-	i = sprintf(buf, "%lu", (unsigned long int)t);
-	if (DEBUG)
-		printf("daemons limit: %s\n", buf);
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite daemons\n");
-
-	fclose(f);
-
-	/* mkdir /sys/fs/cgroup/memory/apps */
-	mkdir("/sys/fs/cgroup/memory/apps", 755);
-//		pabort("mkdir /sys/fs/cgroup/memory/apps");
-
-	/* echo 80%*MemTotal > /sys/fs/cgroup/memory/apps/memory.limit_in_bytes */
-	f = fopen("/sys/fs/cgroup/memory/apps/memory.limit_in_bytes", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/apps/memory.limit_in_bytes");
-
-	t = (float)apps_mem_percent / 100 * memtotal;
-	i = sprintf(buf, "%lu", (unsigned long int)t);
-	// debug
-//	i = sprintf(buf, "%lu", 100000000UL);
-	if (DEBUG)
-		printf("apps limit: %s\n", buf);
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite apps\n");
-
-	fclose(f);
-
-	/* disable kernel OOM killer */
-	i = sprintf(buf, "1");
-
-	f = fopen("/sys/fs/cgroup/memory/daemons/memory.oom_control", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/daemons/memory.oom_control");
-
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite daemons/memory.oom_control\n");
-
-	fclose(f);
+	for (i = 0; i < nr_classes; i++) {
+		cg_state[i].procs_fd = -1;
+		limits[i] = (float)classes[i].percent / 100 * memtotal;
+	}
 
-	f = fopen("/sys/fs/cgroup/memory/apps/memory.oom_control", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/apps/memory.oom_control");
+	free_cgroups();
 
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite apps/memory.oom_control\n");
+	cg_ops->init(limits);
 
-	fclose(f);
+	free(limits);
 }
 
 /**
- *	add_pid_to_daemons_cgroup - add PID to daemons cgroup
- *	@pid: task PID number
+ *	get_mem_usage - get memory usage
+ *	@idx: task type index
  *
- *	Adds given @pid to deamons cgroup's tasks file.
+ *	Returns cgroup's (corresponding to given @idx) memory usage
+ *	in bytes.
  */
-void add_pid_to_daemons_cgroup(pid_t pid)
+long long get_mem_usage(int idx)
 {
-	FILE *f;
-	char buf[4096];
-	int i;
-
-	f = fopen("/sys/fs/cgroup/memory/daemons/tasks", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/deamons/tasks");
-
-	i = sprintf(buf, "%u", (unsigned int)pid);
-	if (DEBUG)
-		printf("adding pid %u to daemons cgroup\n", pid);
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite daemons tasks\n");
-
-	fclose(f);
+	return cg_ops->get_mem_usage(idx);
 }
 
 /**
- *	add_pid_to_apps_cgroup - add PID to apps cgroup
- *	@pid: task PID number
+ *	thres_bytes - get memory threshold level in bytes
+ *	@limit: cgroup memory limit (in bytes)
+ *	@percent: threshold level (percent of @limit)
  *
- *	Adds given @pid to apps cgroup's tasks file.
+ *	Returns @percent of @limit but no more than @limit minus
+ *	CG_THRES_MARGIN (so the threshold is crossed before reaching
+ *	the limit).
  */
-void add_pid_to_apps_cgroup(pid_t pid)
+long long thres_bytes(long long limit, int percent)
 {
-	FILE *f;
-	char buf[4096];
-	int i;
+	long long thresb = limit / 100 * percent;
 
-	f = fopen("/sys/fs/cgroup/memory/apps/tasks", "w");
-	if (!f)
-		pabort("fopen /sys/fs/cgroup/memory/apps/tasks");
+	if (thresb > limit - CG_THRES_MARGIN)
+		thresb = limit - CG_THRES_MARGIN;
 
-	i = sprintf(buf, "%u", (unsigned int)pid);
-	if (DEBUG)
-		printf("adding pid %u to apps cgroup\n", pid);
-	if (fwrite(buf, i, 1, f) != 1)
-		pabort("fwrite apps tasks\n");
-
-	fclose(f);
+	return thresb;
 }
 
-static char *cg_class[] = { "daemons", "apps" };
-
 /**
- *	get_mem_limit - get memory limit
+ *	setup_events - setup memory threshold events
  *	@idx: task type index
  *
- *	Gets cgroup's (corresponding to given @idx) memory limit by
- *	reading limit_in_bytes file.  Returns cgroup's memory limit
- *	in bytes.
+ *	Setups events for exceeding classes[@idx].levels[] memory
+ *	threshold levels and sets levels' file descriptors (and poll
+ *	events) they are signaled on (-1 file descriptor for levels
+ *	without events).
  */
-static long long get_mem_limit(int idx)
+int setup_events(int idx)
 {
-	char buf[100];
-	int mfd;
-	int i;
-	long long thresb;
-
-	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.limit_in_bytes",
-		    cg_class[idx]);
-	mfd = open(buf, O_RDONLY);
-	if (mfd < 0)
-		pabort("open limit_in_bytes");
-
-	i = read(mfd, buf, sizeof(buf));
-	if (i <= 0)
-		pabort("read limit_in_bytes");
-
-	thresb = strtoll(buf, NULL, 10);
-	if (DEBUG)
-		printf("%s: limit_in_bytes=%lld\n", cg_class[idx], thresb);
-
-	close(mfd);
-
-	return thresb;
+	return cg_ops->setup_events(idx);
 }
 
 /**
- *	get_mem_usage - get memory usage
+ *	cleanup_events - cleanup memory threshold events
  *	@idx: task type index
  *
- *	Gets cgroup's (corresponding to given @idx) memory usage by
- *	reading usage_in_bytes file.  Returns cgroup's memory usage
- *	in bytes.
+ *	Cleanups events setup by setup_events().
  */
-long long get_mem_usage(int idx)
+void cleanup_events(int idx)
 {
-	char buf[100];
-	int mfd;
-	int i;
-	long long thresb;
+	cg_ops->cleanup_events(idx);
+}
 
-	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.usage_in_bytes",
-		    cg_class[idx]);
-	mfd = open(buf, O_RDONLY);
-	if (mfd < 0)
-		pabort("open usage_in_bytes");
+/**
+ *	process_event - process memory threshold event
+ *	@idx: task type index
+ *	@level: memory threshold level
+ *
+ *	Processes (acknowledges) event setup by setup_events().
+ */
+void process_event(int idx, int level)
+{
+	cg_ops->process_event(idx, level);
+}
 
-	i = read(mfd, buf, sizeof(buf));
-	if (i <= 0)
-		pabort("read usage_in_bytes");
+/*
+ * Cached cgroup membership: one PID bitmap per cgroup, rebuilt from
+ * the cgroup's cgroup.procs file on the first lookup after it was
+ * invalidated by invalidate_cgroup_members() (which is done once per
+ * scan cycle) and kept up to date by add_pid_to_cgroup().
+ */
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
 
-	thresb = strtoll(buf, NULL, 10);
-	if (DEBUG)
-		printf("%s: usage_in_bytes=%lld\n", cg_class[idx], thresb);
+/**
+ *	set_cgroup_member - set PID bit in cgroup membership bitmap
+ *	@idx: task type index
+ *	@pid: task PID number
+ *
+ *	Grows the bitmap if @pid doesn't fit in it.
+ */
+static void set_cgroup_member(int idx, unsigned int pid)
+{
+	struct cg_state *cg = &cg_state[idx];
+
+	if (pid >= cg->members_bits) {
+		unsigned int old_longs = cg->members_bits / BITS_PER_LONG;
+		unsigned int longs = pid / BITS_PER_LONG + 1;
+
+		/* start with pid_max sized bitmap (32768 by default) */
+		if (longs < 32768 / BITS_PER_LONG)
+			longs = 32768 / BITS_PER_LONG;
+		if (longs < 2 * old_longs)
+			longs = 2 * old_longs;
+
+		cg->members = realloc(cg->members,
+				      longs * sizeof(unsigned long));
+		if (!cg->members)
+			pabort("realloc cg_members");
+		memset(cg->members + old_longs, 0,
+		       (longs - old_longs) * sizeof(unsigned long));
+		cg->members_bits = longs * BITS_PER_LONG;
+	}
 
-	close(mfd);
+	cg->members[pid / BITS_PER_LONG] |= 1UL << (pid % BITS_PER_LONG);
+}
 
-	return thresb;
+/**
+ *	clear_cgroup_member - clear PID bit in cgroup membership bitmap
+ *	@idx: task type index
+ *	@pid: task PID number
+ */
+static void clear_cgroup_member(int idx, unsigned int pid)
+{
+	if (pid < cg_state[idx].members_bits)
+		cg_state[idx].members[pid / BITS_PER_LONG] &=
+			~(1UL << (pid % BITS_PER_LONG));
 }
 
 /**
- *	setup_events - setup eventfd event
- *	@pollfds: pollfd instance
+ *	refresh_cgroup_members - rebuild cgroup membership bitmap
  *	@idx: task type index
  *
- *	Setups eventfd event for crossing mem_thresholds[@idx]
- *	memory threshold (which is setup to memory.limit_in_bytes
- *	minus 6 MiB) by memory.usage_in_bytes.
- *
- *	TODO: make memory threshold tunable
+ *	Parses cgroup's cgroup.procs file once and stores all PIDs
+ *	found there in the membership bitmap.
  */
-int setup_events(struct pollfd *pollfds, int idx)
+static void refresh_cgroup_members(int idx)
 {
-	struct mem_threshold *thres = &mem_thresholds[idx];
-	char buf[100];
-	char *ctl;
-	int mfd, cfd, efd;
-	long long thresb;
-	int ret;
-	ssize_t sz;
-	int i;
-
-	thresb = thres->mem_limit = get_mem_limit(idx) - (6 << 20);
-
-	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.usage_in_bytes",
-		    cg_class[idx]);
-	mfd = open(buf, O_RDONLY);
-	if (mfd < 0)
-		pabort("open usage_in_bytes");
-
-	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/cgroup.event_control",
-		    cg_class[idx]);
-	cfd = open(buf, O_WRONLY);
-	if (cfd < 0)
-		pabort("open event_control");
-
-//	efd = eventfd(0, EFD_NONBLOCK);
-	efd = eventfd(0, 0);
-	if (efd < 0)
-		pabort("event fd");
+	FILE *f;
+	char buf[PATH_MAX];
 
-	i = fcntl(efd, F_SETFL, O_NONBLOCK);
-	if (i)
-		pabort("fcntl fd");
+	if (cg_state[idx].members)
+		memset(cg_state[idx].members, 0,
+		       cg_state[idx].members_bits / BITS_PER_LONG *
+		       sizeof(unsigned long));
 
-	sz = asprintf(&ctl, "%d %d %lld", efd, mfd, thresb);
-	if (sz < 0)
-		pabort("asprintf ctl");
-	sz += 1;
+	snprintf(buf, sizeof(buf), "%s/%s/cgroup.procs", cg_ops->root,
+		 classes[idx].name);
 
-	ret = write(cfd, ctl, sz);
-	if (ret != sz)
-		pabort("write cfd");
+	f = fopen(buf, "r");
+	if (!f)
+		pabort("fopen cgroup.procs file");
 
-	if (DEBUG)
-		printf("registered event %s\n", ctl);
+	while (fgets(buf, sizeof(buf), f)) {
+		char *end;
+		unsigned long pid = strtoul(buf, &end, 10);
 
-	thres->mfd = mfd;
-	thres->cfd = cfd;
-	thres->efd = efd;
+		if (end == buf)
+			break;
 
-	pollfds[idx].fd = efd;
-	pollfds[idx].events = POLLIN;
+		set_cgroup_member(idx, pid);
+	}
 
-	free(ctl);
+	fclose(f);
 
-	return 0;
+	cg_state[idx].members_valid = 1;
 }
 
 /**
- *	cleanup_events - cleanup eventfd event
- *	@idx: task type index
+ *	invalidate_cgroup_members - invalidate cached cgroup membership
  *
- *	Cleanups eventfd event setup by setup_events().
+ *	Makes the next check_pid_in_cgroup() call re-read the cgroup's
+ *	cgroup.procs file.
  */
-void cleanup_events(int idx)
+void invalidate_cgroup_members(void)
 {
-	struct mem_threshold *thres = &mem_thresholds[idx];
-
-	if (close(thres->efd))
-		pabort("close eventfd");
+	int i;
 
-	close(thres->cfd);
-	close(thres->mfd);
+	for (i = 0; i < nr_classes; i++)
+		cg_state[i].members_valid = 0;
 }
 
 /**
- *	process_events - process eventfd event
+ *	check_pid_in_cgroup - check pid existance in cgroup
+ *	@pid: task PID number
  *	@idx: task type index
  *
- *	Processes eventfd event setup by setup_events().
- *	In practice it just reads mem_thresholds[idx].efd
- *	file descriptor.
+ *	Checks @pid existance in cgroup's cgroup.procs file using cached
+ *	membership bitmap.  Returns '1' on success, '0' on failure.
  */
-void process_event(int idx)
+int check_pid_in_cgroup(pid_t pid, int idx)
 {
-	struct mem_threshold *thres = &mem_thresholds[idx];
-	uint64_t result;
-	int ret;
+	if (!cg_state[idx].members_valid)
+		refresh_cgroup_members(idx);
 
-	ret = read(thres->efd, &result, sizeof(result));
-	if (ret < 0)
-		pabort("read efd");
+	if ((unsigned int)pid >= cg_state[idx].members_bits)
+		return 0;
 
-	if (DEBUG)
-		printf("%s: res %lld B\n", cg_class[idx],
-			thres->mem_limit);
+	return !!(cg_state[idx].members[pid / BITS_PER_LONG] &
+		  (1UL << (pid % BITS_PER_LONG)));
 }
 
 /**
- *	check_pid_in_cgroup - check pid existance in cgroup's tasks file
+ *	add_pid_to_cgroup - add PID to cgroup
  *	@pid: task PID number
  *	@idx: task type index
  *
- *	Checks @pid existance in cgroup's tasks file.  Returns '1' on
- *	success, '0' on failure.
+ *	Moves @pid thread group to cgroup (identified by @idx) by
+ *	writing it to cgroup's cgroup.procs file (which is opened
+ *	on the first use and then kept open).  Failures (i.e. the
+ *	task has already exited) are ignored.
  */
-int check_pid_in_cgroup(pid_t pid, int idx)
+void add_pid_to_cgroup(pid_t pid, int idx)
 {
-	FILE *f;
-	char buf[4096];
+	char buf[PATH_MAX];
 	int i;
-	unsigned int tmp;
-
-	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/tasks", cg_class[idx]);
 
-	f = fopen(buf, "r");
-	if (!f)
-		pabort("fopen tasks file");
-
-	while (fgets(buf, sizeof(buf), f)) {
-		if (sscanf(buf, "%u", &tmp) != 1) {
-			fclose(f);
-			return 0;
-		} else {
-			if (pid == tmp)
-				return 1;
-		}
+	if (cg_state[idx].procs_fd < 0) {
+		snprintf(buf, sizeof(buf), "%s/%s/cgroup.procs",
+			 cg_ops->root, classes[idx].name);
+		cg_state[idx].procs_fd = open(buf, O_WRONLY | O_CLOEXEC);
+		if (cg_state[idx].procs_fd < 0)
+			pabort("open cgroup.procs");
 	}
 
-	fclose(f);
+	i = sprintf(buf, "%u", (unsigned int)pid);
+	if (DEBUG)
+		printf("adding pid %u to %s cgroup\n", pid, classes[idx].name);
+	if (write(cg_state[idx].procs_fd, buf, i) != i) {
+		if (DEBUG)
+			perror("write cgroup.procs");
+		return;
+	}
 
-	return 0;
+	for (i = 0; i < nr_classes; i++) {
+		if (!cg_state[i].members_valid)
+			continue;
+		if (i == idx)
+			set_cgroup_member(i, pid);
+		else
+			clear_cgroup_member(i, pid);
+	}
 }
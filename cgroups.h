@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_CGROUPS_H
+#define __TBULMKD_CGROUPS_H
+
+/* memory threshold is set this much below the cgroup memory limit */
+#define CG_THRES_MARGIN (6 << 20)
+
+/*
+ * Memory controller backend.  Per-class cgroups are @root/<class name>
+ * directories, each having a cgroup.procs file (used directly by the
+ * common code for adding tasks and membership checks).
+ *
+ * @probe returns non-zero if the backend can be used (it may set
+ * @root).  @init creates per-class cgroups with @limits (in bytes)
+ * memory limits, @free removes them.  @setup_events sets up memory
+ * threshold level events for a class (see setup_events()),
+ * @process_event acknowledges a level event and @cleanup_events tears
+ * them down.  @get_mem_usage returns current class cgroup memory
+ * usage.
+ */
+struct cgroup_ops {
+	const char *name;
+	const char *root;
+	int (*probe)(void);
+	void (*init)(unsigned long *limits);
+	void (*free)(void);
+	long long (*get_mem_usage)(int idx);
+	int (*setup_events)(int idx);
+	void (*cleanup_events)(int idx);
+	void (*process_event)(int idx, int level);
+};
+
+extern struct cgroup_ops cgroup_v1_ops;
+extern struct cgroup_ops cgroup_v2_ops;
+
+long long thres_bytes(long long limit, int percent);
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * heavily based on Userspace low memory killer daemon:
+ * Copyright 2012  Linaro Limited
+ * Author: Anton Vorontsov <anton.vorontsov@linaro.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <string.h>
+#include <poll.h>
+#include "tbulmkd.h"
+#include "cgroups.h"
+#include "common.h"
+
+/**
+ *	cg1_free - free cgroups v1 resources
+ *
+ *	Removes per-class sysfs memory cgroups, then unmounts/removes
+ *	cgroups memory controller subsystem and finally unmounts
+ *	cgroups subsystem itself.
+ */
+static void cg1_free(void)
+{
+	char buf[100];
+	int i;
+
+	for (i = 0; i < nr_classes; i++) {
+		snprintf(buf, sizeof(buf), "/sys/fs/cgroup/memory/%s",
+			 classes[i].name);
+		rmdir(buf);
+	}
+
+	umount("/sys/fs/cgroup/memory");
+	rmdir("/sys/fs/cgroup/memory");
+	umount("/sys/fs/cgroup");
+}
+
+/**
+ *	cg1_init - init cgroups v1 resources
+ *	@limits: per-class memory limits (in bytes)
+ *
+ *	Mounts cgroups subsystem and creates/mounts cgroups memory
+ *	controller subsystem.  Then creates per-class sysfs memory
+ *	cgroups and sets their memory limits.  Finally, it disables
+ *	the in-kernel OOM killer.
+ */
+static void cg1_init(unsigned long *limits)
+{
+	FILE *f;
+	char buf[100], path[100];
+	int i, j;
+
+	/* mount -t tmpfs none /sys/fs/cgroup */
+	if (mount(NULL, "/sys/fs/cgroup", "tmpfs", 0, NULL))
+		pabort("mount /sys/fs/cgroup");
+
+	/* mkdir /sys/fs/cgroup/memory */
+	if (mkdir("/sys/fs/cgroup/memory", 755))
+		pabort("mkdir /sys/fs/cgroup/memory");
+
+	/* mount -t cgroup none /sys/fs/cgroup/memory -o memory */
+	if (mount(NULL, "/sys/fs/cgroup/memory", "cgroup", 0, "memory"))
+		pabort("mount /sys/fs/cgroup/memory");
+
+	for (i = 0; i < nr_classes; i++) {
+		/* mkdir /sys/fs/cgroup/memory/<class> */
+		snprintf(path, sizeof(path), "/sys/fs/cgroup/memory/%s",
+			 classes[i].name);
+		mkdir(path, 755);
+
+		/* echo limit > <class>/memory.limit_in_bytes */
+		snprintf(path, sizeof(path),
+			 "/sys/fs/cgroup/memory/%s/memory.limit_in_bytes",
+			 classes[i].name);
+		f = fopen(path, "w");
+		if (!f)
+			pabort(path);
+
+		j = sprintf(buf, "%lu", limits[i]);
+		if (DEBUG)
+			printf("%s limit: %s\n", classes[i].name, buf);
+		if (fwrite(buf, j, 1, f) != 1)
+			pabort(path);
+
+		fclose(f);
+
+		/* disable kernel OOM killer */
+		snprintf(path, sizeof(path),
+			 "/sys/fs/cgroup/memory/%s/memory.oom_control",
+			 classes[i].name);
+		f = fopen(path, "w");
+		if (!f)
+			pabort(path);
+
+		if (fwrite("1", 1, 1, f) != 1)
+			pabort(path);
+
+		fclose(f);
+	}
+}
+
+/**
+ *	cg1_probe - check cgroups v1 availability
+ *
+ *	cgroups v1 memory controller is mounted by cg1_init() itself
+ *	so it is always assumed to be available.
+ */
+static int cg1_probe(void)
+{
+	return 1;
+}
+
+/**
+ *	get_mem_limit - get memory limit
+ *	@idx: task type index
+ *
+ *	Gets cgroup's (corresponding to given @idx) memory limit by
+ *	reading limit_in_bytes file.  Returns cgroup's memory limit
+ *	in bytes.
+ */
+static long long get_mem_limit(int idx)
+{
+	char buf[100];
+	int mfd;
+	int i;
+	long long thresb;
+
+	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.limit_in_bytes",
+		    classes[idx].name);
+	mfd = open(buf, O_RDONLY);
+	if (mfd < 0)
+		pabort("open limit_in_bytes");
+
+	i = read(mfd, buf, sizeof(buf));
+	if (i <= 0)
+		pabort("read limit_in_bytes");
+
+	thresb = strtoll(buf, NULL, 10);
+	if (DEBUG)
+		printf("%s: limit_in_bytes=%lld\n", classes[idx].name, thresb);
+
+	close(mfd);
+
+	return thresb;
+}
+
+/**
+ *	cg1_get_mem_usage - get memory usage
+ *	@idx: task type index
+ *
+ *	Gets cgroup's (corresponding to given @idx) memory usage by
+ *	reading usage_in_bytes file.  Returns cgroup's memory usage
+ *	in bytes.
+ */
+static long long cg1_get_mem_usage(int idx)
+{
+	char buf[100];
+	int mfd;
+	int i;
+	long long thresb;
+
+	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.usage_in_bytes",
+		    classes[idx].name);
+	mfd = open(buf, O_RDONLY);
+	if (mfd < 0)
+		pabort("open usage_in_bytes");
+
+	i = read(mfd, buf, sizeof(buf));
+	if (i <= 0)
+		pabort("read usage_in_bytes");
+
+	thresb = strtoll(buf, NULL, 10);
+	if (DEBUG)
+		printf("%s: usage_in_bytes=%lld\n", classes[idx].name, thresb);
+
+	close(mfd);
+
+	return thresb;
+}
+
+/**
+ *	cg1_setup_level - setup eventfd event for memory threshold level
+ *	@idx: task type index
+ *	@level: memory threshold level
+ *	@limit: cgroup memory limit (in bytes)
+ *
+ *	Setups eventfd event for crossing classes[@idx].levels[@level]
+ *	memory threshold by memory.usage_in_bytes.  The event fires
+ *	on crossing the threshold in both directions.
+ */
+static void cg1_setup_level(int idx, int level, long long limit)
+{
+	struct mem_threshold *thres = &classes[idx].levels[level];
+	char buf[100];
+	char *ctl;
+	int mfd, cfd, efd;
+	long long thresb;
+	int ret;
+	ssize_t sz;
+	int i;
+
+	thresb = thres->mem_limit = thres_bytes(limit, thres->percent);
+
+	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/memory.usage_in_bytes",
+		    classes[idx].name);
+	mfd = open(buf, O_RDONLY);
+	if (mfd < 0)
+		pabort("open usage_in_bytes");
+
+	i = sprintf(buf, "/sys/fs/cgroup/memory/%s/cgroup.event_control",
+		    classes[idx].name);
+	cfd = open(buf, O_WRONLY);
+	if (cfd < 0)
+		pabort("open event_control");
+
+//	efd = eventfd(0, EFD_NONBLOCK);
+	efd = eventfd(0, 0);
+	if (efd < 0)
+		pabort("event fd");
+
+	i = fcntl(efd, F_SETFL, O_NONBLOCK);
+	if (i)
+		pabort("fcntl fd");
+
+	sz = asprintf(&ctl, "%d %d %lld", efd, mfd, thresb);
+	if (sz < 0)
+		pabort("asprintf ctl");
+	sz += 1;
+
+	ret = write(cfd, ctl, sz);
+	if (ret != sz)
+		pabort("write cfd");
+
+	if (DEBUG)
+		printf("registered event %s\n", ctl);
+
+	thres->mfd = mfd;
+	thres->cfd = cfd;
+	thres->efd = efd;
+	thres->events = POLLIN;
+
+	free(ctl);
+}
+
+/**
+ *	cg1_setup_events - setup eventfd events
+ *	@idx: task type index
+ *
+ *	Setups eventfd events for all memory threshold levels of
+ *	cgroup (identified by @idx), see cg1_setup_level().
+ */
+static int cg1_setup_events(int idx)
+{
+	long long limit = get_mem_limit(idx);
+	int i;
+
+	for (i = 0; i < classes[idx].nr_levels; i++)
+		cg1_setup_level(idx, i, limit);
+
+	return 0;
+}
+
+/**
+ *	cg1_cleanup_events - cleanup eventfd events
+ *	@idx: task type index
+ *
+ *	Cleanups eventfd events setup by cg1_setup_events().
+ */
+static void cg1_cleanup_events(int idx)
+{
+	int i;
+
+	for (i = 0; i < classes[idx].nr_levels; i++) {
+		struct mem_threshold *thres = &classes[idx].levels[i];
+
+		if (close(thres->efd))
+			pabort("close eventfd");
+
+		close(thres->cfd);
+		close(thres->mfd);
+	}
+}
+
+/**
+ *	cg1_process_event - process eventfd event
+ *	@idx: task type index
+ *	@level: memory threshold level
+ *
+ *	Processes eventfd event setup by cg1_setup_level().
+ *	In practice it just reads classes[idx].levels[level].efd
+ *	file descriptor.
+ */
+static void cg1_process_event(int idx, int level)
+{
+	struct mem_threshold *thres = &classes[idx].levels[level];
+	uint64_t result;
+	int ret;
+
+	ret = read(thres->efd, &result, sizeof(result));
+	if (ret < 0)
+		pabort("read efd");
+
+	if (DEBUG)
+		printf("%s: res %lld B\n", classes[idx].name,
+			thres->mem_limit);
+}
+
+struct cgroup_ops cgroup_v1_ops = {
+	.name		= "v1",
+	.root		= "/sys/fs/cgroup/memory",
+	.probe		= cg1_probe,
+	.init		= cg1_init,
+	.free		= cg1_free,
+	.get_mem_usage	= cg1_get_mem_usage,
+	.setup_events	= cg1_setup_events,
+	.cleanup_events	= cg1_cleanup_events,
+	.process_event	= cg1_process_event,
+};
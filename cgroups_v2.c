@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <poll.h>
+#include "tbulmkd.h"
+#include "cgroups.h"
+#include "common.h"
+
+/*
+ * Per-class cgroups live in a "tbulmkd" cgroup created just below the
+ * root of the unified hierarchy (so the memory controller can be
+ * enabled for them even if the root cgroup has tasks).
+ */
+#define CG2_DIR "tbulmkd"
+
+#define CG2_MNT_MAX 256
+
+/* mount point of the unified hierarchy */
+static char cg2_mnt[CG2_MNT_MAX];
+static char cg2_root[CG2_MNT_MAX + sizeof(CG2_DIR)];
+
+/**
+ *	cg2_path - build cgroups v2 file path
+ *	@buf: path buffer (PATH_MAX bytes)
+ *	@idx: task type index (or -1 for the tbulmkd cgroup itself)
+ *	@file: file name
+ */
+static char *cg2_path(char *buf, int idx, const char *file)
+{
+	if (idx < 0)
+		snprintf(buf, PATH_MAX, "%s/%s", cg2_root, file);
+	else
+		snprintf(buf, PATH_MAX, "%s/%s/%s", cg2_root, classes[idx].name,
+			 file);
+
+	return buf;
+}
+
+/**
+ *	cg2_write - write a cgroups v2 file
+ *	@path: file path
+ *	@val: value to write
+ */
+static void cg2_write(const char *path, const char *val)
+{
+	int fd;
+	int len = strlen(val);
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		pabort(path);
+
+	if (write(fd, val, len) != len)
+		pabort(path);
+
+	close(fd);
+}
+
+/**
+ *	cg2_read_bytes - read a cgroups v2 memory amount file
+ *	@idx: task type index
+ *	@file: file name (e.g. memory.current or memory.high)
+ *
+ *	Returns memory amount in bytes ("max" is returned as LLONG_MAX).
+ */
+static long long cg2_read_bytes(int idx, const char *file)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	long long val;
+	int fd;
+	int i;
+
+	fd = open(cg2_path(path, idx, file), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		pabort(path);
+
+	i = read(fd, buf, sizeof(buf) - 1);
+	if (i <= 0)
+		pabort(path);
+	buf[i] = 0;
+
+	close(fd);
+
+	if (!strncmp(buf, "max", 3))
+		val = LLONG_MAX;
+	else
+		val = strtoll(buf, NULL, 10);
+
+	if (DEBUG)
+		printf("%s: %s=%lld\n", classes[idx].name, file, val);
+
+	return val;
+}
+
+/**
+ *	cg2_probe - check cgroups v2 availability
+ *
+ *	Looks for the unified hierarchy mount point in /proc/self/mounts
+ *	and checks whether the memory controller is available there.
+ */
+static int cg2_probe(void)
+{
+	FILE *f;
+	char buf[4096];
+	char mnt[CG2_MNT_MAX], type[32];
+	int found = 0;
+
+	f = fopen("/proc/self/mounts", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		if (sscanf(buf, "%*s %255s %31s", mnt, type) != 2)
+			continue;
+		if (!strcmp(type, "cgroup2")) {
+			found = 1;
+			break;
+		}
+	}
+
+	fclose(f);
+
+	if (!found)
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%s/cgroup.controllers", mnt);
+	f = fopen(buf, "r");
+	if (!f)
+		return 0;
+
+	found = 0;
+	while (fscanf(f, "%31s", type) == 1) {
+		if (!strcmp(type, "memory")) {
+			found = 1;
+			break;
+		}
+	}
+
+	fclose(f);
+
+	if (!found)
+		return 0;
+
+	strcpy(cg2_mnt, mnt);
+	snprintf(cg2_root, sizeof(cg2_root), "%s/" CG2_DIR, cg2_mnt);
+
+	return 1;
+}
+
+/**
+ *	cg2_free - free cgroups v2 resources
+ *
+ *	Removes per-class memory cgroups and the
+ *	tbulmkd cgroup containing them.
+ */
+static void cg2_free(void)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < nr_classes; i++) {
+		snprintf(path, sizeof(path), "%s/%s", cg2_root,
+			 classes[i].name);
+		rmdir(path);
+	}
+
+	rmdir(cg2_root);
+}
+
+/**
+ *	cg2_init - init cgroups v2 resources
+ *	@limits: per-class memory limits (in bytes)
+ *
+ *	Enables memory controller for the tbulmkd cgroup and creates
+ *	per-class memory cgroups in it.  memory.max is
+ *	set to the class memory limit and memory.high to the highest
+ *	memory threshold level (so the class is throttled and
+ *	memory.events "high" events are generated before hitting the
+ *	limit).  There is no
+ *	way to disable the in-kernel OOM killer in cgroups v2, it will
+ *	still be invoked when memory.max is reached.
+ */
+static void cg2_init(unsigned long *limits)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	int i;
+
+	snprintf(path, sizeof(path), "%s/cgroup.subtree_control", cg2_mnt);
+	cg2_write(path, "+memory");
+
+	if (mkdir(cg2_root, 0755) && errno != EEXIST)
+		pabort("mkdir " CG2_DIR " cgroup");
+
+	cg2_write(cg2_path(path, -1, "cgroup.subtree_control"), "+memory");
+
+	for (i = 0; i < nr_classes; i++) {
+		snprintf(path, sizeof(path), "%s/%s", cg2_root,
+			 classes[i].name);
+		if (mkdir(path, 0755) && errno != EEXIST)
+			pabort("mkdir class cgroup");
+
+		sprintf(buf, "%lu", limits[i]);
+		if (DEBUG)
+			printf("%s limit: %s\n", classes[i].name, buf);
+		cg2_write(cg2_path(path, i, "memory.max"), buf);
+
+		sprintf(buf, "%lld", thres_bytes(limits[i],
+			classes[i].levels[classes[i].nr_levels - 1].percent));
+		cg2_write(cg2_path(path, i, "memory.high"), buf);
+	}
+}
+
+/**
+ *	cg2_get_mem_usage - get memory usage
+ *	@idx: task type index
+ *
+ *	Gets cgroup's (corresponding to given @idx) memory usage by
+ *	reading memory.current file.  Returns cgroup's memory usage
+ *	in bytes.
+ */
+static long long cg2_get_mem_usage(int idx)
+{
+	return cg2_read_bytes(idx, "memory.current");
+}
+
+/**
+ *	cg2_process_event - process memory.events event
+ *	@idx: task type index
+ *	@level: memory threshold level
+ *
+ *	Re-reads cgroup's memory.events file (which re-arms the
+ *	notification).
+ */
+static void cg2_process_event(int idx, int level)
+{
+	struct mem_threshold *thres = &classes[idx].levels[level];
+	char buf[256];
+	int i;
+
+	i = pread(thres->efd, buf, sizeof(buf) - 1, 0);
+	if (i < 0)
+		pabort("read memory.events");
+	buf[i] = 0;
+
+	if (DEBUG)
+		printf("%s: memory.events\n%s", classes[idx].name, buf);
+}
+
+/**
+ *	cg2_setup_events - setup memory.events event
+ *	@idx: task type index
+ *
+ *	Setups notification of cgroup's memory.events file changes
+ *	(signaled by POLLPRI) which happen (among others) every time
+ *	memory.high is exceeded.  The notification is used for the
+ *	highest memory threshold level (memory.high is set to it by
+ *	cg2_init()), lower levels have no event and have to be checked
+ *	by sampling memory usage.
+ */
+static int cg2_setup_events(int idx)
+{
+	int top = classes[idx].nr_levels - 1;
+	struct mem_threshold *thres;
+	char path[PATH_MAX];
+	long long limit;
+	int i;
+
+	limit = cg2_read_bytes(idx, "memory.max");
+
+	for (i = 0; i <= top; i++) {
+		thres = &classes[idx].levels[i];
+		thres->mem_limit = thres_bytes(limit, thres->percent);
+		thres->mfd = -1;
+		thres->cfd = -1;
+		thres->efd = -1;
+		thres->events = POLLPRI;
+	}
+
+	thres = &classes[idx].levels[top];
+	thres->efd = open(cg2_path(path, idx, "memory.events"),
+			  O_RDONLY | O_CLOEXEC);
+	if (thres->efd < 0)
+		pabort("open memory.events");
+
+	cg2_process_event(idx, top);
+
+	return 0;
+}
+
+/**
+ *	cg2_cleanup_events - cleanup memory.events event
+ *	@idx: task type index
+ *
+ *	Cleanups event setup by cg2_setup_events().
+ */
+static void cg2_cleanup_events(int idx)
+{
+	close(classes[idx].levels[classes[idx].nr_levels - 1].efd);
+}
+
+struct cgroup_ops cgroup_v2_ops = {
+	.name		= "v2",
+	.root		= cg2_root,
+	.probe		= cg2_probe,
+	.init		= cg2_init,
+	.free		= cg2_free,
+	.get_mem_usage	= cg2_get_mem_usage,
+	.setup_events	= cg2_setup_events,
+	.cleanup_events	= cg2_cleanup_events,
+	.process_event	= cg2_process_event,
+};
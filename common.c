@@ -43,39 +43,227 @@ void print_timestamp(void)
 }
 
 /**
- *	parse_stat - parse /proc/$pid/stat information
- *	@s: stat string
- *	@ti: task info instance
+ *	now_ms - get monotonic time
  *
- *	Parse @s stat string extracting task name, TTY number
- *	and RSS value in pages (stat entries 1, 6 and 23) and
- *	storing them in @ti task info instance.
+ *	Returns CLOCK_MONOTONIC time in milliseconds.
  */
-static void parse_stat(char *s, struct task_info *ti)
+long long now_ms(void)
 {
-	char *_s = s;
-	int i = 0;
+	struct timespec ts;
 
-	while (1) {
-		s = strtok(_s, " ");
-		if (!s)
-			break;
-		switch (i) {
-		case 1:
-			ti->name = strdup(s + 1);
-			ti->name[strlen(s) - 2] = '\0';
-			break;
-		case 6:
-			ti->tty_nr = atoi(s);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * /proc/$pid/stat field numbers (as in proc(5), counting from 1)
+ */
+#define STAT_STATE		3	/* first field after the task name */
+#define STAT_TTY_NR		7
+#define STAT_START_TIME		22
+#define STAT_RSS		24
+
+/*
+ * Word-at-a-time scanning: byte_mask() returns a word with the high
+ * bit set in every byte of @v which is equal to @c (and all the other
+ * bits cleared).  There are no carries between the bytes so the result
+ * is exact.
+ */
+#define WORD_ONES	(~0UL / 0xff)
+#define WORD_HIGHS	(WORD_ONES * 0x80)
+
+static inline unsigned long byte_mask(unsigned long v, unsigned char c)
+{
+	unsigned long x = v ^ (WORD_ONES * c);
+
+	return ~(((x & ~WORD_HIGHS) + ~WORD_HIGHS) | x | ~WORD_HIGHS);
+}
+
+/**
+ *	find_last_paren - find the last ')' character
+ *	@s: start of the string
+ *	@end: end of the string
+ *
+ *	Returns pointer to the last ')' in @s or NULL if not found.
+ */
+static const char *find_last_paren(const char *s, const char *end)
+{
+	const char *p = end;
+
+	while (p - s >= sizeof(unsigned long)) {
+		unsigned long v;
+
+		memcpy(&v, p - sizeof(v), sizeof(v));
+		if (byte_mask(v, ')'))
 			break;
-		case 23:
-			ti->rss = atoi(s);
-			return;
+		p -= sizeof(v);
+	}
+
+	while (p > s)
+		if (*--p == ')')
+			return p;
+
+	return NULL;
+}
+
+/**
+ *	skip_fields - skip space separated fields
+ *	@p: current position
+ *	@end: end of the string
+ *	@n: number of fields to skip
+ *
+ *	Returns pointer to the first character after the @n-th space
+ *	following @p or NULL if there are not enough fields.
+ */
+static const char *skip_fields(const char *p, const char *end, int n)
+{
+	while (n) {
+		if (end - p >= sizeof(unsigned long)) {
+			unsigned long v;
+			int nr;
+
+			memcpy(&v, p, sizeof(v));
+			nr = __builtin_popcountl(byte_mask(v, ' '));
+			if (nr < n) {
+				n -= nr;
+				p += sizeof(v);
+				continue;
+			}
 		}
-		_s = NULL;
-		i++;
+
+		if (p == end)
+			return NULL;
+		if (*p++ == ' ')
+			n--;
+	}
+
+	return p;
+}
+
+/**
+ *	parse_ull - parse decimal number
+ *	@p: current position
+ *	@end: end of the string
+ *	@val: parsed value
+ *
+ *	Returns pointer to the first character after the number or
+ *	NULL if there is no number at @p.  Negative numbers are
+ *	parsed as 0.
+ */
+static const char *parse_ull(const char *p, const char *end,
+			     unsigned long long *val)
+{
+	const char *start;
+	int neg = 0;
+
+	*val = 0;
+
+	if (p < end && *p == '-') {
+		neg = 1;
+		p++;
 	}
-	pabort("/proc/pid/stat parse");
+
+	for (start = p; p < end && *p >= '0' && *p <= '9'; p++)
+		*val = *val * 10 + (*p - '0');
+
+	if (p == start)
+		return NULL;
+
+	if (neg)
+		*val = 0;
+
+	return p;
+}
+
+/**
+ *	parse_stat - parse /proc/$pid/stat information
+ *	@s: stat string
+ *	@len: length of @s
+ *	@ti: task info instance
+ *
+ *	Parse @s stat string extracting task name, TTY number, start
+ *	time and RSS value in pages (stat fields 2, 7, 22 and 24) and
+ *	storing them in @ti task info instance.  The task name may
+ *	contain spaces and parentheses so it ends at the last ')' and
+ *	it is truncated to TASK_COMM_LEN - 1 characters.  Doesn't
+ *	allocate any memory.
+ *
+ *	Returns 0 on success, EBADF on failure (i.e. short read).
+ */
+int parse_stat(const char *s, size_t len, struct task_info *ti)
+{
+	const char *end = s + len;
+	const char *lp, *rp, *p;
+	unsigned long long val;
+
+	lp = memchr(s, '(', len);
+	if (!lp)
+		return EBADF;
+
+	rp = find_last_paren(lp + 1, end);
+	if (!rp)
+		return EBADF;
+
+	len = rp - lp - 1;
+	if (len > TASK_COMM_LEN - 1)
+		len = TASK_COMM_LEN - 1;
+	memcpy(ti->name, lp + 1, len);
+	ti->name[len] = '\0';
+
+	/* ") " precedes the state field */
+	p = rp + 2;
+	if (p >= end)
+		return EBADF;
+
+	p = skip_fields(p, end, STAT_TTY_NR - STAT_STATE);
+	if (!p || !(p = parse_ull(p, end, &val)))
+		return EBADF;
+	ti->tty_nr = val;
+
+	p = skip_fields(p, end, STAT_START_TIME - STAT_TTY_NR);
+	if (!p || !(p = parse_ull(p, end, &val)))
+		return EBADF;
+	ti->start_time = val;
+
+	p = skip_fields(p, end, STAT_RSS - STAT_START_TIME);
+	if (!p || !(p = parse_ull(p, end, &val)))
+		return EBADF;
+	ti->rss = val;
+
+	return 0;
+}
+
+/**
+ *	page_size - get (cached) system page size
+ */
+static ulong page_size(void)
+{
+	static ulong size;
+
+	if (!size)
+		size = sysconf(_SC_PAGESIZE);
+
+	return size;
+}
+
+/**
+ *	parse_task_stat - parse /proc/$pid/stat contents
+ *	@s: stat file contents
+ *	@len: length of @s
+ *	@ti: task info instance
+ *
+ *	Like parse_stat() but converts RSS to bytes.
+ *
+ *	Returns 0 on success, EBADF on failure.
+ */
+int parse_task_stat(const char *s, size_t len, struct task_info *ti)
+{
+	if (parse_stat(s, len, ti))
+		return EBADF;
+	ti->rss = ti->rss * page_size();
+
+	return 0;
 }
 
 /**
@@ -84,9 +272,10 @@ static void parse_stat(char *s, struct task_info *ti)
  *	@dname: task PID string
  *	@ti: task info instance
  *
- *	Get task information (task name, TTY number and RSS value in bytes)
- *	from /proc/$pid/stat using either @pid task PID number or @dname
- *	task PID string and store it in @ti task info instance.
+ *	Get task information (task name, TTY number, start time and RSS
+ *	value in bytes) from /proc/$pid/stat using either @pid task PID
+ *	number or @dname task PID string and store it in @ti task info
+ *	instance.
  *
  *	Returns 0 on success, EBADF on failure.
  */
@@ -112,18 +301,12 @@ int get_task_info_stat(pid_t pid, const char *dname, struct task_info *ti)
 		return EBADF;
 
 	sz = read(stat_fd, buf, sizeof(buf));
-	if (sz <= 0) {
-		close(stat_fd);
+	close(stat_fd);
+	if (sz <= 0)
 		return EBADF;
-	}
 //		pabort("read stat");
 
-	parse_stat(buf, ti);
-	ti->rss = ti->rss * sysconf(_SC_PAGESIZE);
-
-	close(stat_fd);
-
-	return 0;
+	return parse_task_stat(buf, sz, ti);
 }
 
 /**
@@ -132,11 +315,14 @@ int get_task_info_stat(pid_t pid, const char *dname, struct task_info *ti)
  *	@dname: task PID string
  *	@ti: task info instance
  *
- *	Get task information (task name, TTY number and RSS value in bytes)
- *	from /proc/$pid/stat using either @pid task PID number or @dname
- *	task PID string and store it in @ti task info instance. Also get
- *	information about task activity from /proc/$pid/activity and time
- *	of last activity change from /proc/$pid/activity_time.
+ *	Get task information (task name, TTY number, start time and RSS
+ *	value in bytes) from /proc/$pid/stat using either @pid task PID
+ *	number or @dname task PID string and store it in @ti task info
+ *	instance.  Also get information about task activity from
+ *	/proc/$pid/activity and time of last activity change from
+ *	/proc/$pid/activity_time.  If the kernel doesn't provide these
+ *	files (the tbulmkd kernel patch is not applied) activity is set
+ *	to ACTIVITY_UNKNOWN and time to 0.
  *
  *	Returns 0 on success, EBADF on failure.
  */
@@ -161,55 +347,218 @@ int get_task_info(pid_t pid, const char *dname, struct task_info *ti)
 	t = stpcpy(t, "/activity_time");
 
 	activity_time_fd = open(name, O_RDONLY);
-	if (activity_time_fd < 0)
-		return EBADF;
+	if (activity_time_fd < 0) {
+		if (errno != ENOENT)
+			return EBADF;
+		ti->activity = ACTIVITY_UNKNOWN;
+		ti->time = 0;
+		return get_task_info_stat(pid, dname, ti);
+	}
 
 	t = pid_dir_end;
 	t = stpcpy(t, "/activity");
 
 	activity_fd = open(name, O_RDONLY);
 	if (activity_fd < 0)
-		pabort("open activity");
+		goto err_activity_time;
 
 	t = pid_dir_end;
 	t = stpcpy(t, "/stat");
 	stat_fd = open(name, O_RDONLY);
 	if (stat_fd < 0)
-		pabort("open stat");
+		goto err_activity;
 
-	sz = read(activity_time_fd, buf, sizeof(buf));
+	/*
+	 * The task may exit at any time (i.e. just after a fork event
+	 * was received) so read failures are not fatal.
+	 */
+	sz = read(activity_time_fd, buf, sizeof(buf) - 1);
 	if (sz <= 0)
-		pabort("read activity_time");
+		goto err_stat;
+	buf[sz] = '\0';
 
 	ti->time = atoi(buf);
 
-	sz = read(activity_fd, buf, sizeof(buf));
+	sz = read(activity_fd, buf, sizeof(buf) - 1);
 	if (sz <= 0)
-		pabort("read activity");
+		goto err_stat;
+	buf[sz] = '\0';
 
 	ti->activity = atoi(buf);
 
 	sz = read(stat_fd, buf, sizeof(buf));
-	if (sz <= 0)
-		pabort("read stat");
+	if (sz <= 0 || parse_task_stat(buf, sz, ti))
+		goto err_stat;
+
+	close(stat_fd);
+	close(activity_fd);
+	close(activity_time_fd);
 
-	parse_stat(buf, ti);
-	ti->rss = ti->rss * sysconf(_SC_PAGESIZE);
+	return 0;
 
+err_stat:
 	close(stat_fd);
+err_activity:
 	close(activity_fd);
+err_activity_time:
 	close(activity_time_fd);
 
+	return EBADF;
+}
+
+/**
+ *	open_task_files - open /proc/$pid files read by get_task_info()
+ *	@pid: task PID number
+ *	@fds: returned file descriptors (TASK_FILE_*)
+ *	@stat_only: open only /proc/$pid/stat
+ *
+ *	Opens /proc/$pid/stat and (unless @stat_only is set)
+ *	/proc/$pid/activity_time and /proc/$pid/activity files so they
+ *	can be re-read with read_task_files().  Missing activity files
+ *	(see get_task_info()) get -1 file descriptors.
+ *
+ *	Returns 0 on success, EBADF on failure (all @fds are -1 then).
+ */
+int open_task_files(pid_t pid, int *fds, int stat_only)
+{
+	static const char *files[] = {
+		[TASK_FILE_STAT]		= "stat",
+		[TASK_FILE_ACTIVITY_TIME]	= "activity_time",
+		[TASK_FILE_ACTIVITY]		= "activity",
+	};
+	char name[64];
+	int i;
+
+	for (i = 0; i < TASK_FILES; i++)
+		fds[i] = -1;
+
+	for (i = 0; i < (stat_only ? 1 : TASK_FILES); i++) {
+		sprintf(name, "/proc/%d/%s", pid, files[i]);
+		fds[i] = open(name, O_RDONLY | O_CLOEXEC);
+		if (fds[i] >= 0)
+			continue;
+
+		if (i == TASK_FILE_ACTIVITY_TIME && errno == ENOENT)
+			break;
+
+		close_task_files(fds);
+		return EBADF;
+	}
+
 	return 0;
 }
 
 /**
- *	put_task_info - put task information
+ *	read_task_files - get task information from open /proc files
+ *	@fds: file descriptors opened by open_task_files()
  *	@ti: task info instance
  *
- *	Free memory used for task name.
+ *	Like get_task_info() but (re-)reads the files with pread()
+ *	so no /proc path lookups are needed.  The files keep referring
+ *	to the same task, reads fail once it has exited.
+ *
+ *	Returns 0 on success, EBADF on failure.
  */
-void put_task_info(struct task_info *ti)
+int read_task_files(const int *fds, struct task_info *ti)
 {
-	free(ti->name);;
+	char buf[4096];
+	ssize_t sz;
+
+	if (fds[TASK_FILE_ACTIVITY_TIME] < 0) {
+		ti->activity = ACTIVITY_UNKNOWN;
+		ti->time = 0;
+	} else {
+		sz = pread(fds[TASK_FILE_ACTIVITY_TIME], buf,
+			   sizeof(buf) - 1, 0);
+		if (sz <= 0)
+			return EBADF;
+		buf[sz] = '\0';
+		ti->time = atoi(buf);
+
+		sz = pread(fds[TASK_FILE_ACTIVITY], buf, sizeof(buf) - 1, 0);
+		if (sz <= 0)
+			return EBADF;
+		buf[sz] = '\0';
+		ti->activity = atoi(buf);
+	}
+
+	sz = pread(fds[TASK_FILE_STAT], buf, sizeof(buf), 0);
+	if (sz <= 0)
+		return EBADF;
+
+	return parse_task_stat(buf, sz, ti);
+}
+
+/**
+ *	close_task_files - close files opened by open_task_files()
+ *	@fds: file descriptors (set to -1)
+ */
+void close_task_files(int *fds)
+{
+	int i;
+
+	for (i = 0; i < TASK_FILES; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+		fds[i] = -1;
+	}
+}
+
+/**
+ *	get_task_smaps - get task memory usage from smaps_rollup
+ *	@pid: task PID number
+ *	@sm: task memory usage instance
+ *
+ *	Get task memory usage (RSS, PSS, anonymous PSS, private memory,
+ *	swap and swap PSS in bytes) from /proc/$pid/smaps_rollup and
+ *	store it in @sm.  Reading smaps_rollup walks all the task page
+ *	tables so it is much more expensive than reading stat.
+ *
+ *	Returns 0 on success, EBADF on failure.
+ */
+int get_task_smaps(pid_t pid, struct task_smaps *sm)
+{
+	char buf[4096];
+	char *p, *end;
+	ssize_t sz;
+	int fd;
+
+	sprintf(buf, "/proc/%d/smaps_rollup", pid);
+	fd = open(buf, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return EBADF;
+
+	sz = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (sz <= 0)
+		return EBADF;
+	buf[sz] = '\0';
+
+	memset(sm, 0, sizeof(*sm));
+
+	/* the first line is the (dummy) VMA header */
+	for (p = strchr(buf, '\n'); p && *++p; p = strchr(p, '\n')) {
+		ulong kb;
+
+		end = strchr(p, ':');
+		if (!end)
+			break;
+		kb = strtoul(end + 1, NULL, 10) << 10;
+
+		if (!strncmp(p, "Rss:", 4))
+			sm->rss = kb;
+		else if (!strncmp(p, "Pss:", 4))
+			sm->pss = kb;
+		else if (!strncmp(p, "Pss_Anon:", 9))
+			sm->pss_anon = kb;
+		else if (!strncmp(p, "Private_Clean:", 14) ||
+			 !strncmp(p, "Private_Dirty:", 14))
+			sm->private += kb;
+		else if (!strncmp(p, "Swap:", 5))
+			sm->swap = kb;
+		else if (!strncmp(p, "SwapPss:", 8))
+			sm->swap_pss = kb;
+	}
+
+	return 0;
 }
@@ -17,18 +17,53 @@
 
 extern void pabort(const char *s);
 extern void print_timestamp(void);
+extern long long now_ms(void);
 
 typedef unsigned long ulong;
 
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+#define TASK_COMM_LEN		16
+
+/* task_info activity of tasks without /proc/$pid/activity files */
+#define ACTIVITY_UNKNOWN	-1
+
 struct task_info {
-	char *name;
+	char name[TASK_COMM_LEN];
 	time_t time;
 	int activity;
 	ulong rss;
 	int tty_nr;
+	unsigned long long start_time; /* in clock ticks after boot */
 };
 
+int parse_stat(const char *s, size_t len, struct task_info *ti);
+int parse_task_stat(const char *s, size_t len, struct task_info *ti);
+int get_task_info_stat(pid_t pid, const char *dname, struct task_info *ti);
 int get_task_info(pid_t pid, const char *dname, struct task_info *ti);
-void put_task_info(struct task_info *ti);
+
+/* /proc/$pid files read by get_task_info() */
+enum {
+	TASK_FILE_STAT,
+	TASK_FILE_ACTIVITY_TIME,
+	TASK_FILE_ACTIVITY,
+	TASK_FILES,
+};
+
+int open_task_files(pid_t pid, int *fds, int stat_only);
+int read_task_files(const int *fds, struct task_info *ti);
+void close_task_files(int *fds);
+
+/* task memory usage from /proc/$pid/smaps_rollup (in bytes) */
+struct task_smaps {
+	ulong rss;
+	ulong pss;
+	ulong pss_anon;
+	ulong private;	/* Private_Clean + Private_Dirty (USS) */
+	ulong swap;
+	ulong swap_pss;
+};
+
+int get_task_smaps(pid_t pid, struct task_smaps *sm);
 
 #endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "common.h"
+#include "shm.h"
+#include "tbulmkd.h"
+
+/*
+ * Exemption list ("exemption <pattern>" config lines) is compiled
+ * into three matchers:
+ * - plain task names go to a hash set (open addressing),
+ * - "prefix*" patterns go to a prefix trie,
+ * - all other glob patterns are matched with fnmatch(3).
+ * Task names are at most TASK_COMM_LEN - 1 bytes so patterns are
+ * truncated to that length (the kernel truncates task names too).
+ */
+static char **names;
+static unsigned int names_size;	/* power of 2 */
+static unsigned int nr_names;
+
+struct trie_node {
+	char c;
+	char end;	/* prefix ends here */
+	int child;	/* first child node, -1 if none */
+	int next;	/* next sibling node, -1 if none */
+};
+
+/* node 0 is the root */
+static struct trie_node *trie;
+static int trie_size;
+static int nr_trie_nodes;
+
+static char **globs;
+static int nr_globs;
+
+/* FNV-1a */
+static unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+
+	return h;
+}
+
+/**
+ *	name_slot - find hash set slot of a task name
+ *	@name: task name
+ *
+ *	Returns slot holding @name or the empty slot it would go to.
+ */
+static unsigned int name_slot(const char *name)
+{
+	unsigned int i = name_hash(name) & (names_size - 1);
+
+	while (names[i] && strcmp(names[i], name))
+		i = (i + 1) & (names_size - 1);
+
+	return i;
+}
+
+static void add_name(const char *name)
+{
+	unsigned int i;
+
+	/* keep load factor below 1/2 */
+	if (2 * (nr_names + 1) > names_size) {
+		char **old = names;
+		unsigned int old_size = names_size;
+
+		names_size = names_size ? names_size * 2 : 64;
+		names = calloc(names_size, sizeof(*names));
+		if (!names)
+			pabort("calloc exemption names");
+
+		for (i = 0; i < old_size; i++)
+			if (old[i])
+				names[name_slot(old[i])] = old[i];
+		free(old);
+	}
+
+	i = name_slot(name);
+	if (names[i])
+		return;
+
+	names[i] = strdup(name);
+	nr_names++;
+}
+
+static int new_trie_node(char c)
+{
+	if (nr_trie_nodes == trie_size) {
+		trie_size = trie_size ? trie_size * 2 : 64;
+		trie = realloc(trie, trie_size * sizeof(*trie));
+		if (!trie)
+			pabort("realloc exemption trie");
+	}
+
+	trie[nr_trie_nodes].c = c;
+	trie[nr_trie_nodes].end = 0;
+	trie[nr_trie_nodes].child = -1;
+	trie[nr_trie_nodes].next = -1;
+
+	return nr_trie_nodes++;
+}
+
+static int trie_child(int node, char c)
+{
+	int n;
+
+	for (n = trie[node].child; n >= 0; n = trie[n].next)
+		if (trie[n].c == c)
+			return n;
+
+	return -1;
+}
+
+static void add_prefix(const char *prefix, int len)
+{
+	int node = 0, i;
+
+	if (!nr_trie_nodes)
+		new_trie_node(0);
+
+	for (i = 0; i < len; i++) {
+		int n = trie_child(node, prefix[i]);
+
+		if (n < 0) {
+			n = new_trie_node(prefix[i]);
+			trie[n].next = trie[node].child;
+			trie[node].child = n;
+		}
+		node = n;
+	}
+
+	trie[node].end = 1;
+}
+
+static int match_prefix(const char *name)
+{
+	int node = 0;
+
+	if (!nr_trie_nodes)
+		return 0;
+
+	while (1) {
+		if (trie[node].end)
+			return 1;
+		if (!*name)
+			return 0;
+		node = trie_child(node, *name++);
+		if (node < 0)
+			return 0;
+	}
+}
+
+/**
+ *	add_exemption - add exemption list entry
+ *	@pattern: task name or glob pattern
+ */
+void add_exemption(const char *pattern)
+{
+	char buf[TASK_COMM_LEN];
+	int len = strcspn(pattern, "*?[\\");
+
+	if (!pattern[len]) {
+		snprintf(buf, sizeof(buf), "%s", pattern);
+		add_name(buf);
+	} else if (!strcmp(pattern + len, "*")) {
+		add_prefix(pattern, len < TASK_COMM_LEN - 1 ?
+			   len : TASK_COMM_LEN - 1);
+	} else {
+		globs = realloc(globs, (nr_globs + 1) * sizeof(*globs));
+		if (!globs)
+			pabort("realloc exemption globs");
+		globs[nr_globs++] = strdup(pattern);
+	}
+}
+
+/**
+ *	task_exempted - check whether task is exempted
+ *	@name: task name
+ *
+ *	The result is cached per task by update_task() (see tasks.c)
+ *	so each task is normally matched only once.
+ */
+int task_exempted(const char *name)
+{
+	int i;
+
+	if (nr_names && names[name_slot(name)])
+		return 1;
+
+	if (match_prefix(name))
+		return 1;
+
+	for (i = 0; i < nr_globs; i++)
+		if (!fnmatch(globs[i], name, 0))
+			return 1;
+
+	return 0;
+}
+
+static void print_prefixes(int node, char *buf, int len)
+{
+	int n;
+
+	if (trie[node].end)
+		printf("\t%.*s*\n", len, buf);
+
+	for (n = trie[node].child; n >= 0; n = trie[n].next) {
+		buf[len] = trie[n].c;
+		print_prefixes(n, buf, len + 1);
+	}
+}
+
+/**
+ *	print_exemptions - print exemption list
+ */
+void print_exemptions(void)
+{
+	char buf[TASK_COMM_LEN];
+	unsigned int i;
+
+	printf("Exemption list:\n");
+
+	for (i = 0; i < names_size; i++)
+		if (names[i])
+			printf("\t%s\n", names[i]);
+
+	if (nr_trie_nodes)
+		print_prefixes(0, buf, 0);
+
+	for (i = 0; i < nr_globs; i++)
+		printf("\t%s\n", globs[i]);
+}
+
+/**
+ *	free_exemptions - free exemption list
+ */
+void free_exemptions(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < names_size; i++)
+		free(names[i]);
+	free(names);
+	names = NULL;
+	names_size = nr_names = 0;
+
+	free(trie);
+	trie = NULL;
+	trie_size = nr_trie_nodes = 0;
+
+	for (i = 0; i < nr_globs; i++)
+		free(globs[i]);
+	free(globs);
+	globs = NULL;
+	nr_globs = 0;
+}
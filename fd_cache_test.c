@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Scanner file descriptor cache test: forces LRU evictions during
+ * a full rescan merge and checks that cached files of tasks whose
+ * results are merged later stay valid.  The cache internals are
+ * static so scanner.c is built as a part of the test.
+ */
+#include "scanner.c"
+
+#include <signal.h>
+#include <sys/wait.h>
+
+#define NR_CACHED	4
+#define NR_NEW		2
+#define NR_CHILDREN	(NR_CACHED + NR_NEW)
+
+static pid_t children[NR_CHILDREN];
+
+static pid_t spawn_child(void)
+{
+	pid_t pid = fork();
+
+	if (pid < 0)
+		pabort("fork");
+
+	if (!pid) {
+		pause();
+		_exit(0);
+	}
+
+	return pid;
+}
+
+/**
+ *	check_cache - check cached files of all tasks
+ *
+ *	Returns number of cache entries holding closed files or files
+ *	of another task.
+ */
+static int check_cache(void)
+{
+	int i, f, bad = 0, nr = 0;
+
+	for (i = 0; i < nr_tasks; i++) {
+		struct task_info ti;
+
+		if (task_fds[i].fd[0] < 0)
+			continue;
+		nr++;
+
+		for (f = 0; f < TASK_FILES; f++) {
+			int fd = task_fds[i].fd[f];
+
+			if (fd >= 0 && fcntl(fd, F_GETFD) < 0) {
+				printf("pid %d: cached fd %d is closed\n",
+				       task_table[i].pid, fd);
+				bad++;
+				break;
+			}
+		}
+		if (f < TASK_FILES)
+			continue;
+
+		if (read_task_files(task_fds[i].fd, &ti) ||
+		    ti.start_time != task_table[i].start_time) {
+			printf("pid %d: cached files of another task\n",
+			       task_table[i].pid);
+			bad++;
+		}
+	}
+
+	if (nr != nr_cached || nr_cached > fd_cache_max) {
+		printf("%d cached entries, nr_cached %d, max %d\n", nr,
+		       nr_cached, fd_cache_max);
+		bad++;
+	}
+
+	return bad;
+}
+
+int main(void)
+{
+	int i, bad;
+
+	tasklist = tasklist_create(NULL);
+	fd_cache_max = NR_CACHED;
+
+	for (i = 0; i < NR_CHILDREN; i++)
+		children[i] = spawn_child();
+
+	/* fill the cache with the first NR_CACHED children */
+	for (i = 0; i < NR_CACHED; i++)
+		if (update_task(children[i]) < 0)
+			pabort("update_task");
+
+	/*
+	 * Rescan with the new children first: caching their files
+	 * finds the cache full while results of the cached children
+	 * (which are at the LRU tail) are not merged yet.
+	 */
+	scan_results_size = NR_CHILDREN;
+	scan_results = calloc(scan_results_size, sizeof(*scan_results));
+	if (!scan_results)
+		pabort("calloc scan_results");
+
+	nr_scan_results = 0;
+	for (i = 0; i < NR_NEW; i++)
+		prepare_scan(&scan_results[nr_scan_results++],
+			     children[NR_CACHED + i]);
+	for (i = 0; i < NR_CACHED; i++)
+		prepare_scan(&scan_results[nr_scan_results++], children[i]);
+
+	scan_next = 0;
+	scan_chunks();
+	merge_scan_results();
+
+	bad = check_cache();
+
+	for (i = 0; i < NR_CHILDREN; i++) {
+		kill(children[i], SIGKILL);
+		waitpid(children[i], NULL, 0);
+	}
+
+	printf("fd cache test: %s\n", bad ? "FAILED" : "passed");
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include "common.h"
+#include "heap.h"
+
+static inline void heap_set(struct heap *h, int pos, int id)
+{
+	h->ids[pos] = id;
+	h->set_pos(id, pos);
+}
+
+static void heap_sift_up(struct heap *h, int pos)
+{
+	int id = h->ids[pos];
+
+	while (pos) {
+		int parent = (pos - 1) / 2;
+
+		if (!h->before(id, h->ids[parent]))
+			break;
+
+		heap_set(h, pos, h->ids[parent]);
+		pos = parent;
+	}
+
+	heap_set(h, pos, id);
+}
+
+static void heap_sift_down(struct heap *h, int pos)
+{
+	int id = h->ids[pos];
+
+	while (1) {
+		int child = 2 * pos + 1;
+
+		if (child >= h->nr)
+			break;
+
+		if (child + 1 < h->nr &&
+		    h->before(h->ids[child + 1], h->ids[child]))
+			child++;
+
+		if (!h->before(h->ids[child], id))
+			break;
+
+		heap_set(h, pos, h->ids[child]);
+		pos = child;
+	}
+
+	heap_set(h, pos, id);
+}
+
+/**
+ *	heap_push - add id to heap
+ *	@h: heap
+ *	@id: id
+ */
+void heap_push(struct heap *h, int id)
+{
+	if (h->nr == h->size) {
+		h->size = h->size ? h->size * 2 : 64;
+		h->ids = realloc(h->ids, h->size * sizeof(*h->ids));
+		if (!h->ids)
+			pabort("realloc heap");
+	}
+
+	h->ids[h->nr++] = id;
+	heap_sift_up(h, h->nr - 1);
+}
+
+/**
+ *	heap_fix - restore heap order after key change
+ *	@h: heap
+ *	@pos: position of the changed id
+ */
+void heap_fix(struct heap *h, int pos)
+{
+	if (pos && h->before(h->ids[pos], h->ids[(pos - 1) / 2]))
+		heap_sift_up(h, pos);
+	else
+		heap_sift_down(h, pos);
+}
+
+/**
+ *	heap_del - remove id from heap
+ *	@h: heap
+ *	@pos: position of the id
+ */
+void heap_del(struct heap *h, int pos)
+{
+	int id = h->ids[pos];
+
+	if (pos != --h->nr) {
+		h->ids[pos] = h->ids[h->nr];
+		heap_fix(h, pos);
+	}
+
+	h->set_pos(id, -1);
+}
+
+/**
+ *	heap_pop - remove top id from heap
+ *	@h: heap
+ *
+ *	Returns the removed id or -1 if @h is empty.
+ */
+int heap_pop(struct heap *h)
+{
+	int id = heap_top(h);
+
+	if (id >= 0)
+		heap_del(h, 0);
+
+	return id;
+}
+
+/**
+ *	heap_free - free heap
+ *	@h: heap
+ */
+void heap_free(struct heap *h)
+{
+	free(h->ids);
+	h->ids = NULL;
+	h->nr = h->size = 0;
+}
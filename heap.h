@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_HEAP_H
+#define __TBULMKD_HEAP_H
+
+/*
+ * Binary heap of integer ids.  @before(a, b) returns non-zero if id @a
+ * should be closer to the top than id @b.  @set_pos(id, pos) is called
+ * whenever an id changes its position so the owner can later update
+ * (heap_fix()) or remove (heap_del()) it.  Removed ids get position -1.
+ */
+struct heap {
+	int *ids;
+	int nr;
+	int size;
+	int (*before)(int a, int b);
+	void (*set_pos)(int id, int pos);
+};
+
+void heap_push(struct heap *h, int id);
+void heap_del(struct heap *h, int pos);
+void heap_fix(struct heap *h, int pos);
+int heap_pop(struct heap *h);
+void heap_free(struct heap *h);
+
+static inline int heap_top(struct heap *h)
+{
+	return h->nr ? h->ids[0] : -1;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "tbulmkd.h"
+
+/* the same on all architectures using the generic syscall table */
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal	424
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open		434
+#endif
+#ifndef __NR_process_mrelease
+#define __NR_process_mrelease	448
+#endif
+
+static int pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(__NR_pidfd_open, pid, flags);
+}
+
+static int pidfd_send_signal(int pidfd, int sig, siginfo_t *info,
+			     unsigned int flags)
+{
+	return syscall(__NR_pidfd_send_signal, pidfd, sig, info, flags);
+}
+
+static int process_mrelease(int pidfd, unsigned int flags)
+{
+	return syscall(__NR_process_mrelease, pidfd, flags);
+}
+
+/* set once pidfd_open() is known to be unsupported */
+static int no_pidfd;
+
+/**
+ *	check_task - check task identity
+ *	@pid: task PID number
+ *	@start_time: expected task start time
+ *	@ti: task info instance (may be NULL)
+ *
+ *	Re-reads /proc/$pid/stat (into @ti if given) and checks that
+ *	@pid still belongs to the task started at @start_time.
+ *	Returns 0 on success, ESRCH on failure.
+ */
+static int check_task(pid_t pid, unsigned long long start_time,
+		      struct task_info *ti)
+{
+	struct task_info _ti;
+
+	if (!ti)
+		ti = &_ti;
+
+	if (get_task_info_stat(pid, NULL, ti))
+		return ESRCH;
+
+	return ti->start_time == start_time ? 0 : ESRCH;
+}
+
+/**
+ *	kill_task - kill task and release its memory
+ *	@pid: task PID number
+ *	@start_time: task start time (from the task list)
+ *	@ti: task info instance for the re-read task information
+ *	     (may be NULL)
+ *	@pidfdp: returned pidfd of the killed task (may be NULL)
+ *
+ *	Opens a pidfd for @pid, verifies that it refers to the task
+ *	started at @start_time (so a reused PID is never killed), sends
+ *	SIGKILL through the pidfd and then calls process_mrelease() to
+ *	reap the task's address space without waiting for it to finish
+ *	exiting.  Falls back to plain kill() on kernels without pidfd
+ *	support.
+ *
+ *	If @pidfdp is given the pidfd (or -1 if not available) is
+ *	stored there and the caller has to close it (it becomes
+ *	readable once the task has exited).
+ *
+ *	Returns 0 on success, ESRCH if the task is gone.
+ */
+int kill_task(pid_t pid, unsigned long long start_time,
+	      struct task_info *ti, int *pidfdp)
+{
+	int pidfd = -1;
+	int ret;
+
+	if (pidfdp)
+		*pidfdp = -1;
+
+	if (!no_pidfd) {
+		pidfd = pidfd_open(pid, 0);
+		if (pidfd < 0) {
+			if (errno != ENOSYS)
+				return ESRCH;
+			no_pidfd = 1;
+		}
+	}
+
+	/* the pidfd pins @pid so the check can't race with its reuse */
+	ret = check_task(pid, start_time, ti);
+	if (ret)
+		goto out;
+
+	if (pidfd < 0) {
+		if (kill(pid, SIGKILL))
+			ret = ESRCH;
+		return ret;
+	}
+
+	if (pidfd_send_signal(pidfd, SIGKILL, NULL, 0)) {
+		ret = ESRCH;
+		goto out;
+	}
+
+	if (process_mrelease(pidfd, 0) && DEBUG && errno != ENOSYS) {
+		print_timestamp();
+		printf("process_mrelease %d failed errno=%d\n", pid, errno);
+	}
+
+	if (pidfdp) {
+		*pidfdp = pidfd;
+		return 0;
+	}
+out:
+	close(pidfd);
+	return ret;
+}
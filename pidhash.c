@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "pidhash.h"
+
+#define PIDHASH_INIT_SIZE 1024
+
+static inline unsigned int pidhash_slot(struct pidhash *h, pid_t pid)
+{
+	return ((unsigned int)pid * 2654435761U) & (h->size - 1);
+}
+
+/**
+ *	pidhash_resize - resize PID hash table
+ *	@h: hash table
+ *	@size: new number of slots (power of 2)
+ */
+static void pidhash_resize(struct pidhash *h, unsigned int size)
+{
+	struct pidhash_entry *old = h->entries;
+	unsigned int old_size = h->size;
+	unsigned int i;
+
+	h->entries = calloc(size, sizeof(*h->entries));
+	if (!h->entries)
+		pabort("calloc pidhash");
+	h->size = size;
+	h->nr = 0;
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].pid)
+			pidhash_insert(h, old[i].pid, old[i].val);
+
+	free(old);
+}
+
+/**
+ *	pidhash_lookup - lookup PID
+ *	@h: hash table
+ *	@pid: task PID number
+ *
+ *	Returns value stored for @pid or -1 if not found.
+ */
+int pidhash_lookup(struct pidhash *h, pid_t pid)
+{
+	unsigned int i;
+
+	if (!h->size)
+		return -1;
+
+	for (i = pidhash_slot(h, pid); h->entries[i].pid;
+	     i = (i + 1) & (h->size - 1))
+		if (h->entries[i].pid == pid)
+			return h->entries[i].val;
+
+	return -1;
+}
+
+/**
+ *	pidhash_insert - insert or update PID
+ *	@h: hash table
+ *	@pid: task PID number
+ *	@val: value
+ */
+void pidhash_insert(struct pidhash *h, pid_t pid, int val)
+{
+	unsigned int i;
+
+	/* keep load factor below 1/2 */
+	if (2 * (h->nr + 1) > h->size)
+		pidhash_resize(h, h->size ? h->size * 2 : PIDHASH_INIT_SIZE);
+
+	for (i = pidhash_slot(h, pid); h->entries[i].pid;
+	     i = (i + 1) & (h->size - 1)) {
+		if (h->entries[i].pid == pid) {
+			h->entries[i].val = val;
+			return;
+		}
+	}
+
+	h->entries[i].pid = pid;
+	h->entries[i].val = val;
+	h->nr++;
+}
+
+/**
+ *	pidhash_remove - remove PID
+ *	@h: hash table
+ *	@pid: task PID number
+ *
+ *	Removes @pid and shifts back entries following it in the probe
+ *	sequence (so no tombstones are needed).
+ */
+void pidhash_remove(struct pidhash *h, pid_t pid)
+{
+	unsigned int mask = h->size - 1;
+	unsigned int i, j;
+
+	if (!h->size)
+		return;
+
+	for (i = pidhash_slot(h, pid); h->entries[i].pid != pid;
+	     i = (i + 1) & mask)
+		if (!h->entries[i].pid)
+			return;
+
+	for (j = (i + 1) & mask; h->entries[j].pid; j = (j + 1) & mask) {
+		unsigned int k = pidhash_slot(h, h->entries[j].pid);
+
+		/* move entry j to i unless its home slot k is in (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		h->entries[i] = h->entries[j];
+		i = j;
+	}
+
+	h->entries[i].pid = 0;
+	h->nr--;
+}
+
+/**
+ *	pidhash_clear - remove all PIDs
+ *	@h: hash table
+ */
+void pidhash_clear(struct pidhash *h)
+{
+	if (h->size)
+		memset(h->entries, 0, h->size * sizeof(*h->entries));
+	h->nr = 0;
+}
+
+/**
+ *	pidhash_free - free PID hash table
+ *	@h: hash table
+ */
+void pidhash_free(struct pidhash *h)
+{
+	free(h->entries);
+	memset(h, 0, sizeof(*h));
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_PIDHASH_H
+#define __TBULMKD_PIDHASH_H
+
+#include <sys/types.h>
+
+/*
+ * Open addressing PID -> int hash table (linear probing, PID 0 marks
+ * an empty slot).
+ */
+struct pidhash_entry {
+	pid_t pid;
+	int val;
+};
+
+struct pidhash {
+	struct pidhash_entry *entries;
+	unsigned int size; /* power of 2 */
+	unsigned int nr;
+};
+
+int pidhash_lookup(struct pidhash *h, pid_t pid);
+void pidhash_insert(struct pidhash *h, pid_t pid, int val);
+void pidhash_remove(struct pidhash *h, pid_t pid);
+void pidhash_clear(struct pidhash *h);
+void pidhash_free(struct pidhash *h);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "common.h"
+#include "shm.h"
+#include "tbulmkd.h"
+
+/* score of tasks which must not be killed by a policy */
+#define NO_VICTIM LLONG_MIN
+
+/* victim scoring weights ("weight <name> <value>" config lines) */
+enum {
+	WEIGHT_RSS,	/* per MiB of RSS */
+	WEIGHT_AGE,	/* per minute in background */
+	WEIGHT_OOM,	/* per oom_score_adj point */
+	WEIGHT_RECENT,	/* per rank among the most recent bg tasks */
+	WEIGHT_FG,	/* foreground task */
+	WEIGHT_NR,
+};
+
+static const char *weight_names[] = {
+	[WEIGHT_RSS]	= "rss",
+	[WEIGHT_AGE]	= "age",
+	[WEIGHT_OOM]	= "oom",
+	[WEIGHT_RECENT]	= "recent",
+	[WEIGHT_FG]	= "fg",
+};
+
+static int weights[WEIGHT_NR] = {
+	[WEIGHT_RSS]	= 1,
+	[WEIGHT_AGE]	= 1,
+	[WEIGHT_OOM]	= 0,
+	[WEIGHT_RECENT]	= 100,
+	[WEIGHT_FG]	= 1000,
+};
+
+/*
+ * Victim scoring policy.  @score returns score of a candidate task
+ * (tasks with higher scores are killed first) or NO_VICTIM if the
+ * policy never kills the task.
+ */
+struct victim_policy {
+	const char *name;
+	long long (*score)(struct task *t, time_t now);
+};
+
+/* policy used by THRES_KILL_SCORE levels ("policy <name>" line) */
+int victim_policy = POLICY_WEIGHTED;
+
+/* task_mem() accounting budget end of the current selection */
+static long long budget_end;
+
+/* background tasks (see update_recent_tasks()) */
+static struct task **bg_tasks;
+static int bg_tasks_size;
+
+/**
+ *	task_oom_score_adj - get task oom_score_adj value
+ *	@t: task_table[] entry
+ *
+ *	Reads /proc/$pid/oom_score_adj once per task (the value is
+ *	cached until the task execs).
+ */
+static int task_oom_score_adj(struct task *t)
+{
+	char buf[32];
+	int fd, i;
+
+	if (t->oom_adj_valid)
+		return t->oom_adj;
+
+	sprintf(buf, "/proc/%d/oom_score_adj", t->info.pid);
+	fd = open(buf, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	i = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (i <= 0)
+		return 0;
+	buf[i] = 0;
+
+	t->oom_adj = atoi(buf);
+	t->oom_adj_valid = 1;
+
+	return t->oom_adj;
+}
+
+static long long rss_score(struct task *t, time_t now)
+{
+	return task_mem(t, budget_end);
+}
+
+static long long stale_score(struct task *t, time_t now)
+{
+	if (t->info.activity || t->recent_rank >= 0)
+		return NO_VICTIM;
+
+	return now - t->info.time;
+}
+
+static long long weighted_score(struct task *t, time_t now)
+{
+	long long score = (long long)weights[WEIGHT_RSS] *
+			  (task_mem(t, budget_end) >> 20);
+
+	if (t->info.activity)
+		score -= weights[WEIGHT_FG];
+	else
+		score += (long long)weights[WEIGHT_AGE] *
+			 ((now - t->info.time) / 60);
+
+	if (t->recent_rank >= 0)
+		score -= (long long)weights[WEIGHT_RECENT] *
+			 (MAX_LIVE_BG_TASKS - t->recent_rank);
+
+	if (weights[WEIGHT_OOM])
+		score += (long long)weights[WEIGHT_OOM] * task_oom_score_adj(t);
+
+	return score;
+}
+
+static const struct victim_policy policies[] = {
+	[POLICY_RSS]		= { "rss",	rss_score },
+	[POLICY_STALE]		= { "stale",	stale_score },
+	[POLICY_WEIGHTED]	= { "weighted",	weighted_score },
+};
+
+/**
+ *	set_victim_policy - select victim scoring policy
+ *	@name: policy name
+ */
+void set_victim_policy(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(policies); i++) {
+		if (!strcmp(policies[i].name, name)) {
+			victim_policy = i;
+			return;
+		}
+	}
+
+	printf("invalid policy %s\n", name);
+}
+
+/**
+ *	set_policy_weight - set victim scoring weight
+ *	@name: weight name
+ *	@value: weight value
+ */
+void set_policy_weight(const char *name, int value)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(weight_names); i++) {
+		if (!strcmp(weight_names[i], name)) {
+			weights[i] = value;
+			return;
+		}
+	}
+
+	printf("invalid weight %s %d\n", name, value);
+}
+
+static inline int more_recent(struct task *a, struct task *b)
+{
+	return a->info.time > b->info.time;
+}
+
+static inline void swap_tasks(struct task **a, struct task **b)
+{
+	struct task *t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+/**
+ *	select_recent - partially sort tasks by activity time
+ *	@ts: tasks
+ *	@nr: number of tasks
+ *	@k: number of tasks to select
+ *
+ *	Moves @k most recent tasks to the beginning of @ts (in no
+ *	particular order) using quickselect.
+ */
+static void select_recent(struct task **ts, int nr, int k)
+{
+	int lo = 0, hi = nr - 1;
+
+	while (lo < hi) {
+		struct task *pivot = ts[lo + (hi - lo) / 2];
+		int i = lo, j = hi;
+
+		while (i <= j) {
+			while (more_recent(ts[i], pivot))
+				i++;
+			while (more_recent(pivot, ts[j]))
+				j--;
+			if (i <= j)
+				swap_tasks(&ts[i++], &ts[j--]);
+		}
+
+		if (k - 1 <= j)
+			hi = j;
+		else if (k - 1 >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+/**
+ *	update_recent_tasks - rank most recent background tasks
+ *
+ *	Sets recent_rank of MAX_LIVE_BG_TASKS background tasks with
+ *	the biggest time values (== most recent tasks) to their rank
+ *	(0 for the most recent one) and of all other tasks to -1.
+ *	Killed tasks, kernel threads and exempted tasks are ranked too
+ *	(like with MAX_LIVE_BG_TASKS timeout protection), select_victim()
+ *	skips them.  Uses a single partial sort pass over the background
+ *	tasks.
+ */
+static void update_recent_tasks(void)
+{
+	struct task *t;
+	int nr = 0, k, i, j;
+
+	for (t = next_task(NULL); t; t = next_task(t)) {
+		t->recent_rank = -1;
+
+		if (t->info.activity)
+			continue;
+
+		if (nr == bg_tasks_size) {
+			bg_tasks_size = bg_tasks_size ? bg_tasks_size * 2 : 256;
+			bg_tasks = realloc(bg_tasks,
+					   bg_tasks_size * sizeof(*bg_tasks));
+			if (!bg_tasks)
+				pabort("realloc bg_tasks");
+		}
+
+		bg_tasks[nr++] = t;
+	}
+
+	k = nr < MAX_LIVE_BG_TASKS ? nr : MAX_LIVE_BG_TASKS;
+	select_recent(bg_tasks, nr, k);
+
+	/* insertion sort of the (few) selected ones */
+	for (i = 1; i < k; i++) {
+		t = bg_tasks[i];
+		for (j = i; j > 0 && more_recent(t, bg_tasks[j - 1]); j--)
+			bg_tasks[j] = bg_tasks[j - 1];
+		bg_tasks[j] = t;
+	}
+
+	for (i = 0; i < k; i++) {
+		bg_tasks[i]->recent_rank = i;
+		if (DEBUG)
+			printf("recent bg task %d pid %d time %u\n", i,
+			       bg_tasks[i]->info.pid,
+			       (unsigned)bg_tasks[i]->info.time);
+	}
+}
+
+/**
+ *	select_victim - select task to kill
+ *	@idx: task type index
+ *	@policy: victim scoring policy (POLICY_*)
+ *	@mem: returned memory expected to be freed (see task_mem())
+ *
+ *	Scores @idx class tasks (which belong to a corresponding cgroup
+ *	and are not killed, kernel threads nor exempted) with @policy
+ *	and returns task_table[] entry of the task with the highest
+ *	score or NULL if the policy doesn't allow killing any task.
+ *	Candidates are scored in a single pass, the cgroup membership
+ *	is only checked for tasks beating the best score so far.  The
+ *	memory size of tasks (rss policy and weight) comes from
+ *	task_mem() so smaps_rollup reads are bounded by
+ *	accounting_budget ms per selection.
+ */
+struct task *select_victim(int idx, int policy, ulong *mem)
+{
+	const struct victim_policy *p = &policies[policy];
+	struct task *t, *victim = NULL;
+	long long best = NO_VICTIM;
+	time_t now = time(NULL);
+
+	budget_end = now_ms() + accounting_budget;
+	update_recent_tasks();
+
+	for (t = next_task(NULL); t; t = next_task(t)) {
+		long long score;
+
+		if (t->cls != idx || t->killed || !t->info.rss || t->exempt)
+			continue;
+
+		score = p->score(t, now);
+		if (score == NO_VICTIM || (victim && score <= best))
+			continue;
+
+		if (!check_pid_in_cgroup(t->info.pid, idx))
+			continue;
+
+		victim = t;
+		best = score;
+	}
+
+	if (!victim)
+		return NULL;
+
+	if (DEBUG)
+		printf("%s policy victim %d score %lld\n", p->name,
+		       victim->info.pid, best);
+
+	*mem = task_mem(victim, budget_end);
+
+	return victim;
+}
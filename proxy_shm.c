@@ -13,103 +13,89 @@
  */
 
 #include <stdio.h>
-#include <sys/types.h>
-#include <signal.h>
-#include <dirent.h>
-#include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <semaphore.h>
+#include <getopt.h>
 #include "common.h"
 #include "shm.h"
+#include "scanner.h"
 
-struct tasklist_mem *tasklist_mem;
-
-/**
- *	update_tasks - update tasklist_mem task list
- *
- *	Fill tasklist_mem task list for all tasks in the system using
- *	information from /proc/$pid/stat and /proc/$pid/activity[_time].
- *
- *	tasklist_mem list is terminated by using task entry with PID == 0.
- *
- *	This function needs to take tasklist_sem->sem semaphore to protect
- *	access to tasklist_mem task list.
- */
-static void update_tasks(void)
+static void print_usage(char *argv0)
 {
-	DIR *dir;
-	struct dirent *de;
-	int i = 0;
-
-	dir = opendir("/proc");
-	if (!dir)
-		pabort("opendir proc");
-
-	while ((de = readdir(dir))) {
-		struct task_info ti;
-		const char *dname = de->d_name;
-
-		if (!strcmp(dname, "1") || !strcmp(dname, "self") ||
-		    !strcmp(dname, "."))
-			continue;
-
-		if (get_task_info(0, dname, &ti))
-//		if (get_task_info_stat(0, dname, &ti))
-			continue;
+	printf("Usage: %s [OPTION]...\n"
+	       "\n"
+	       "-n, --netlink	use proc connector events to track tasks\n"
+	       "-a, --activity	take task activity only from activity reports\n"
+	       "-r, --rescan	set full rescan interval (in seconds)\n"
+	       "-j, --jobs	set number of /proc scanning threads\n"
+	       "-u, --uring	read /proc files using io_uring\n"
+	       "-h, --help	display this help message\n"
+	       "\n",
+	       argv0);
+}
 
-		printf("%s %d %u\n", dname, ti.activity, (unsigned)ti.time);
-//		printf("%s %d %lu\n", dname, ti.tty_nr, ti.rss / 1024 / 1024);
+static void parse_args(int argc, char *argv[])
+{
+	struct option opts[] = {
+		{ "netlink",	0, NULL, 'n' },
+		{ "activity",	0, NULL, 'a' },
+		{ "rescan",	1, NULL, 'r' },
+		{ "jobs",	1, NULL, 'j' },
+		{ "uring",	0, NULL, 'u' },
+		{ "help",	0, NULL, 'h' },
+	};
+	int c;
 
-		sem_wait(&tasklist_mem->sem);
-		tasklist_mem->tasks[i].pid = atoi(dname);
-		tasklist_mem->tasks[i].activity = ti.activity;
-		tasklist_mem->tasks[i].time = ti.time;
-//		tasklist_mem->tasks[i].activity = 1;
-//		tasklist_mem->tasks[i].time = time(NULL);
-		tasklist_mem->tasks[i].tty_nr = ti.tty_nr;
-		i++;
-		if (i < MAX_NR_TASKS)
-			tasklist_mem->tasks[i].pid = 0;
-		sem_post(&tasklist_mem->sem);
+	while (1) {
+		c = getopt_long(argc, argv, "nar:j:uh", opts, NULL);
+		if (c < 0)
+			break;
+
+		switch (c) {
+		case 'n':
+			scan_netlink = 1;
+			break;
+		case 'a':
+			scan_activity_only = 1;
+			break;
+		case 'r':
+			scan_rescan_interval = atoi(optarg);
+			if (scan_rescan_interval < 1)
+				scan_rescan_interval = 1;
+			break;
+		case 'j':
+			scan_workers = atoi(optarg);
+			if (scan_workers < 1)
+				scan_workers = 1;
+			break;
+		case 'u':
+			scan_uring = 1;
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			exit(1);
+			break;
+		}
 	}
-
-	closedir(dir);
 }
 
 /*
  * Creates and mmap()s shared memory area containing list of tasks.
- * Then updates tasklist_mem task list once for every second.
+ * Then updates tasklist task list once for every second (or on proc
+ * connector events if netlink support is enabled) and on activity
+ * reports, see scanner.c.
  */
-int main(void)
+int main(int argc, char *argv[])
 {
-	int tasklist_fd;
-	int ret;
-
-	shm_unlink("/tbulmkd_tasklist");
+	scan_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (scan_workers < 1)
+		scan_workers = 1;
 
-	tasklist_fd = shm_open("/tbulmkd_tasklist", O_RDWR | O_CREAT, 0600);
-	if (tasklist_fd < 0)
-		pabort("shm_open tasklist");
+	parse_args(argc, argv);
 
-	ret = ftruncate(tasklist_fd, sizeof(*tasklist_mem));
-	if (ret)
-		pabort("ftruncate");
+	scan_verbose = 1;
+	scanner_init(tasklist_create(TASKLIST_SHM_NAME));
+	scanner_loop();
 
-	tasklist_mem = mmap(NULL, sizeof(*tasklist_mem),
-			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
-			tasklist_fd, 0);
-	if (tasklist_mem == MAP_FAILED)
-		pabort("mmap tasklist");
-
-	sem_init(&tasklist_mem->sem, 1, 1);
-
-	while (1) {
-		update_tasks();
-		sleep(1);
-	}
 	return 0;
 }
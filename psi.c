@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * heavily based on Userspace low memory killer daemon:
+ * Copyright 2012  Linaro Limited
+ * Author: Anton Vorontsov <anton.vorontsov@linaro.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include "tbulmkd.h"
+#include "common.h"
+
+#define PSI_MEMORY_FILE "/proc/pressure/memory"
+
+/**
+ *	psi_open - register memory pressure trigger
+ *	@type: stall type ("some" or "full")
+ *	@stall_us: stall time threshold (in microseconds)
+ *	@window_us: time window (in microseconds)
+ *
+ *	Registers a PSI trigger which fires when tasks (some of them
+ *	or all non-idle ones, depending on @type) were stalled on
+ *	memory for at least @stall_us within @window_us.  The trigger
+ *	is active as long as the returned file descriptor is open and
+ *	it is signaled by POLLPRI (POLLERR means that the trigger is
+ *	gone).  The kernel requires @window_us to be between 500ms and
+ *	10s (and a multiple of 2s without CAP_SYS_RESOURCE).  Returns
+ *	the trigger file descriptor.
+ */
+int psi_open(const char *type, int stall_us, int window_us)
+{
+	char buf[100];
+	int fd;
+	int i;
+
+	fd = open(PSI_MEMORY_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		pabort("open " PSI_MEMORY_FILE);
+
+	i = snprintf(buf, sizeof(buf), "%s %d %d", type, stall_us, window_us);
+
+	/* the trigger string has to include the terminating NUL */
+	if (write(fd, buf, i + 1) != i + 1)
+		pabort("write " PSI_MEMORY_FILE " trigger");
+
+	if (DEBUG)
+		printf("registered psi trigger %s\n", buf);
+
+	return fd;
+}
+
+/**
+ *	psi_close - unregister memory pressure trigger
+ *	@fd: trigger file descriptor
+ *
+ *	Unregisters PSI trigger registered by psi_open().
+ */
+void psi_close(int fd)
+{
+	close(fd);
+}
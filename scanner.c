@@ -0,0 +1,1178 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * heavily based on Userspace low memory killer daemon:
+ * Copyright 2012  Linaro Limited
+ * Author: Anton Vorontsov <anton.vorontsov@linaro.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <dirent.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include "common.h"
+#include "shm.h"
+#include "pidhash.h"
+#include "activity.h"
+#include "scanner.h"
+#include "uring.h"
+
+static struct tasklist *tasklist;
+
+/*
+ * Private copy of the task list.  It is updated either by a full /proc
+ * walk (update_tasks()) or incrementally by proc connector events and
+ * activity reports and then copied to tasklist by publish_tasks().
+ * task_index maps PIDs to task_table[] indices.  task_seen[] holds
+ * the number of the last full /proc walk which found the task.
+ */
+static struct task_info_shm *task_table;
+static unsigned int *task_seen;
+static int task_table_size;
+static int nr_tasks;
+static struct pidhash task_index;
+static unsigned int scan_gen;
+
+/*
+ * Per-task /proc file descriptor cache (see open_task_files()).
+ * task_fds[] entries are parallel to task_table[] ones (fd[0] is -1
+ * for tasks without cached files).  Cached entries are kept on an
+ * LRU list (fd_lru_head is the most recently used one) and at most
+ * fd_cache_max of them are kept (see init_fd_cache()).  The files
+ * refer to the task they were opened for so a PID reuse can't mix
+ * up tasks, reads just fail once the task has exited.
+ */
+struct task_fds {
+	int fd[TASK_FILES];
+	int prev;
+	int next;
+};
+
+static struct task_fds *task_fds;
+static int fd_lru_head = -1;
+static int fd_lru_tail = -1;
+static int nr_cached;
+static int fd_cache_max;
+
+/* file descriptors not available for the cache */
+#define FD_CACHE_RESERVE	64
+
+static int activity_fd = -1;
+
+/* scanner thread stack size (tbulmkd mlock()s all of it) */
+#define SCANNER_STACK_SIZE	(256 * 1024)
+
+/*
+ * Full rescan results.  /proc PIDs are collected to scan_results[]
+ * and their entries are filled by scan_workers threads claiming
+ * SCAN_CHUNK entries at a time (scan_next is the next unclaimed one).
+ */
+struct scan_result {
+	pid_t pid;
+	int err;
+	int fd[TASK_FILES]; /* cached files (in), files to cache (out) */
+	struct task_info ti;
+};
+
+#define SCAN_CHUNK		32
+
+static struct scan_result *scan_results;
+static int scan_results_size;
+static int nr_scan_results;
+static int scan_next;
+static pthread_barrier_t scan_start, scan_done;
+static int workers_started;
+
+int scan_netlink;
+int scan_activity_only;
+int scan_rescan_interval = 10;
+int scan_verbose;
+int scan_workers = 1;
+int scan_uring;
+
+/**
+ *	publish_tasks - publish task list
+ *
+ *	Publish task_table[] as a new tasklist task list snapshot
+ *	(unless it didn't change since the last one, so tbulmkd is
+ *	only woken up by actual changes).
+ */
+static void publish_tasks(void)
+{
+	tasklist_publish(tasklist, task_table, nr_tasks);
+}
+
+static void fd_lru_unlink(int i)
+{
+	struct task_fds *tf = &task_fds[i];
+
+	if (tf->prev >= 0)
+		task_fds[tf->prev].next = tf->next;
+	else
+		fd_lru_head = tf->next;
+
+	if (tf->next >= 0)
+		task_fds[tf->next].prev = tf->prev;
+	else
+		fd_lru_tail = tf->prev;
+}
+
+static void fd_lru_add(int i)
+{
+	struct task_fds *tf = &task_fds[i];
+
+	tf->prev = -1;
+	tf->next = fd_lru_head;
+	if (fd_lru_head >= 0)
+		task_fds[fd_lru_head].prev = i;
+	else
+		fd_lru_tail = i;
+	fd_lru_head = i;
+}
+
+/**
+ *	fd_cache_drop - close cached files of a task
+ *	@i: task entry index
+ */
+static void fd_cache_drop(int i)
+{
+	if (task_fds[i].fd[0] < 0)
+		return;
+
+	close_task_files(task_fds[i].fd);
+	fd_lru_unlink(i);
+	nr_cached--;
+}
+
+/**
+ *	fd_cache_move - move cache entry to another task entry
+ *	@from: old task entry index
+ *	@to: new task entry index (unused)
+ *
+ *	Keeps the LRU list position of the moved entry.
+ */
+static void fd_cache_move(int from, int to)
+{
+	struct task_fds *tf = &task_fds[to];
+
+	*tf = task_fds[from];
+	if (tf->fd[0] < 0)
+		return;
+
+	if (tf->prev >= 0)
+		task_fds[tf->prev].next = to;
+	else
+		fd_lru_head = to;
+
+	if (tf->next >= 0)
+		task_fds[tf->next].prev = to;
+	else
+		fd_lru_tail = to;
+}
+
+/**
+ *	fd_cache_store - update cached files of a task
+ *	@i: task entry index
+ *	@fd: files read for the task (see scan_task())
+ *
+ *	Marks @i entry as the most recently used one if @fd are its
+ *	cached files, otherwise caches @fd instead of the old ones.  If
+ *	the cache is full the least recently used entry is evicted
+ *	unless it has been used by the current full rescan already
+ *	(@fd are closed then, evicting entries that are going to be
+ *	needed again in the same scan would just thrash the cache).
+ */
+static void fd_cache_store(int i, int *fd)
+{
+	if (fd[0] < 0)
+		return;
+
+	if (task_fds[i].fd[0] == fd[0]) {
+		fd_lru_unlink(i);
+		fd_lru_add(i);
+		return;
+	}
+
+	fd_cache_drop(i);
+
+	if (nr_cached >= fd_cache_max) {
+		if (fd_lru_tail < 0 || task_seen[fd_lru_tail] == scan_gen) {
+			close_task_files(fd);
+			return;
+		}
+		fd_cache_drop(fd_lru_tail);
+	}
+
+	memcpy(task_fds[i].fd, fd, sizeof(task_fds[i].fd));
+	fd_lru_add(i);
+	nr_cached++;
+}
+
+/**
+ *	init_fd_cache - set up /proc file descriptor cache
+ *
+ *	Raises RLIMIT_NOFILE soft limit to the hard one and allows
+ *	caching files of as many tasks as the limit permits (minus
+ *	FD_CACHE_RESERVE descriptors for everything else).
+ */
+static void init_fd_cache(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return;
+
+	if (rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX)
+		rl.rlim_cur = INT_MAX;
+
+	if (rl.rlim_cur > FD_CACHE_RESERVE)
+		fd_cache_max = (rl.rlim_cur - FD_CACHE_RESERVE) / TASK_FILES;
+}
+
+/**
+ *	add_task - add task entry to task_table[]
+ *	@pid: task PID number
+ *
+ *	Adds new @pid entry at the end of task_table[] (growing it if
+ *	needed) and returns its index.  The task is foreground since
+ *	now until its activity is known (like with the kernel patch).
+ */
+static int add_task(pid_t pid)
+{
+	int i;
+
+	if (nr_tasks == task_table_size) {
+		task_table_size = task_table_size ? task_table_size * 2 :
+				  TASKLIST_INIT_TASKS;
+		task_table = realloc(task_table,
+				     task_table_size * sizeof(*task_table));
+		task_seen = realloc(task_seen,
+				    task_table_size * sizeof(*task_seen));
+		task_fds = realloc(task_fds,
+				   task_table_size * sizeof(*task_fds));
+		if (!task_table || !task_seen || !task_fds)
+			pabort("realloc task_table");
+	}
+
+	i = nr_tasks++;
+	/* clear name tail too, tasklist_publish() compares whole names */
+	memset(&task_table[i], 0, sizeof(*task_table));
+	task_table[i].pid = pid;
+	task_table[i].activity = 1;
+	task_table[i].time = time(NULL);
+	task_seen[i] = scan_gen;
+	task_fds[i].fd[0] = -1;
+	pidhash_insert(&task_index, pid, i);
+
+	return i;
+}
+
+/**
+ *	del_task - delete task entry from task_table[]
+ *	@i: task entry index
+ *
+ *	Replaces @i entry with the last one.  Cached files of the task
+ *	are closed.
+ */
+static void del_task(int i)
+{
+	pidhash_remove(&task_index, task_table[i].pid);
+	fd_cache_drop(i);
+
+	if (i != --nr_tasks) {
+		task_table[i] = task_table[nr_tasks];
+		task_seen[i] = task_seen[nr_tasks];
+		fd_cache_move(nr_tasks, i);
+		pidhash_insert(&task_index, task_table[i].pid, i);
+	}
+}
+
+/**
+ *	fill_task - fill task entry
+ *	@tis: task_table[] entry
+ *	@ti: task info instance
+ *
+ *	Copies task information from @ti to @tis.  Unknown activity
+ *	(see read_task_info()) keeps the reported one unless the PID
+ *	got reused.
+ */
+static void fill_task(struct task_info_shm *tis, struct task_info *ti)
+{
+	if (ti->activity != ACTIVITY_UNKNOWN) {
+		tis->activity = ti->activity;
+		tis->time = ti->time;
+	} else if (tis->start_time != ti->start_time) {
+		tis->activity = 1;
+		tis->time = time(NULL);
+	}
+	tis->tty_nr = ti->tty_nr;
+	tis->rss = ti->rss;
+	tis->start_time = ti->start_time;
+	memcpy(tis->name, ti->name, TASK_COMM_LEN);
+}
+
+/**
+ *	read_task_info - get task information
+ *	@pid: task PID number
+ *	@dname: task PID string
+ *	@ti: task info instance
+ *
+ *	Gets task information using get_task_info() or, if activity
+ *	is only taken from activity reports (-a), get_task_info_stat()
+ *	so /proc/$pid/activity[_time] files are not even looked up.
+ */
+static int read_task_info(pid_t pid, const char *dname,
+			  struct task_info *ti)
+{
+	if (!scan_activity_only)
+		return get_task_info(pid, dname, ti);
+
+	ti->activity = ACTIVITY_UNKNOWN;
+	ti->time = 0;
+
+	return get_task_info_stat(pid, dname, ti);
+}
+
+/**
+ *	prepare_scan - prepare reading task information
+ *	@r: scan result
+ *	@pid: task PID number
+ *
+ *	Passes cached files of @pid task (if any) to scan_task().
+ */
+static void prepare_scan(struct scan_result *r, pid_t pid)
+{
+	int i = pidhash_lookup(&task_index, pid);
+
+	r->pid = pid;
+	if (i >= 0 && task_fds[i].fd[0] >= 0)
+		memcpy(r->fd, task_fds[i].fd, sizeof(r->fd));
+	else
+		r->fd[0] = -1;
+}
+
+/**
+ *	scan_task - read task information
+ *	@r: scan result prepared by prepare_scan()
+ *
+ *	Re-reads cached files of the task if there are any.  If there
+ *	are none (or the task they refer to has exited, its PID may be
+ *	in use by a new task already) the files are opened (to be
+ *	cached by store_task()) if the cache is enabled, otherwise
+ *	read_task_info() is used.  Only touches @r so it can be run
+ *	by scan workers in parallel.
+ */
+static void scan_task(struct scan_result *r)
+{
+	if (r->fd[0] >= 0) {
+		r->err = read_task_files(r->fd, &r->ti);
+		if (!r->err)
+			return;
+	}
+
+	if (!fd_cache_max) {
+		r->fd[0] = -1;
+		r->err = read_task_info(r->pid, NULL, &r->ti);
+		return;
+	}
+
+	r->err = open_task_files(r->pid, r->fd, scan_activity_only);
+	if (r->err)
+		return;
+
+	r->err = read_task_files(r->fd, &r->ti);
+}
+
+/**
+ *	store_task - store task information in task_table[]
+ *	@r: scan result filled by scan_task()
+ *
+ *	Stores task information in task_table[] (adding a new entry if
+ *	needed) or, if the task couldn't be queried (i.e. it has
+ *	already exited), removes it from task_table[].  Files read
+ *	are cached (see fd_cache_store()), the stale ones are closed.
+ *	Returns task_table[] index of the task or -1 if it is not
+ *	there.
+ */
+static int store_task(struct scan_result *r)
+{
+	int i = pidhash_lookup(&task_index, r->pid);
+
+	/*
+	 * scan_chunk_uring() reads /proc/$pid files by path and keeps
+	 * cached files in @r, they belong to an exited task if the PID
+	 * has been reused since.
+	 */
+	if (i >= 0 && task_fds[i].fd[0] == r->fd[0] && r->fd[0] >= 0 &&
+	    !r->err && task_table[i].start_time != r->ti.start_time)
+		r->fd[0] = -1;
+
+	/* cached files of an exited task */
+	if (i >= 0 && task_fds[i].fd[0] >= 0 &&
+	    task_fds[i].fd[0] != r->fd[0])
+		fd_cache_drop(i);
+
+	if (r->err) {
+		if (i >= 0)
+			del_task(i);
+		else if (r->fd[0] >= 0)
+			close_task_files(r->fd);
+		return -1;
+	}
+
+	if (i < 0)
+		i = add_task(r->pid);
+
+	fill_task(&task_table[i], &r->ti);
+	fd_cache_store(i, r->fd);
+
+	return i;
+}
+
+/**
+ *	update_task - add or refresh task in task_table[]
+ *	@pid: task PID number
+ *
+ *	Gets information about @pid task using scan_task() and
+ *	stores it in task_table[] (see store_task()).  Returns
+ *	task_table[] index of the task or -1 if it is not there.
+ */
+static int update_task(pid_t pid)
+{
+	struct scan_result r;
+
+	if (pid == 1)
+		return -1;
+
+	prepare_scan(&r, pid);
+	scan_task(&r);
+
+	return store_task(&r);
+}
+
+/**
+ *	remove_task - remove task from task_table[]
+ *	@pid: task PID number
+ */
+static void remove_task(pid_t pid)
+{
+	int i = pidhash_lookup(&task_index, pid);
+
+	if (i >= 0)
+		del_task(i);
+}
+
+/*
+ * io_uring scan engine.  Each file of a task is read by a linked
+ * openat (into a fixed file slot) -> read -> close chain so a whole
+ * chunk of scan_results[] is read with a single io_uring_enter()
+ * call instead of up to nine system calls per task.  Every scan
+ * worker has its own ring.  If io_uring can't be used (the kernel
+ * lacks it or direct opens, or it is disabled) scanning falls back
+ * to read_task_info().
+ */
+enum {
+	SCAN_STAT,
+	SCAN_ACTIVITY_TIME,
+	SCAN_ACTIVITY,
+	SCAN_FILES,
+};
+
+enum {
+	SCAN_OPEN,
+	SCAN_READ,
+	SCAN_CLOSE,
+	SCAN_OPS,
+};
+
+static const char *scan_files[] = {
+	[SCAN_STAT]		= "stat",
+	[SCAN_ACTIVITY_TIME]	= "activity_time",
+	[SCAN_ACTIVITY]		= "activity",
+};
+
+#define SCAN_SLOTS		(SCAN_CHUNK * SCAN_FILES)
+#define SCAN_RING_ENTRIES	512	/* >= SCAN_SLOTS * SCAN_OPS */
+#define SCAN_STAT_SIZE		1024	/* enough for fields up to rss */
+#define SCAN_ACTIVITY_SIZE	32
+
+struct scan_ring {
+	struct uring ring;
+	char path[SCAN_SLOTS][32];
+	char stat[SCAN_CHUNK][SCAN_STAT_SIZE];
+	char activity[SCAN_CHUNK][2][SCAN_ACTIVITY_SIZE];
+	int res[SCAN_SLOTS][SCAN_OPS];
+};
+
+static __thread struct scan_ring *scan_ring;
+static int uring_failed;
+
+/**
+ *	queue_file_read - queue reading of a /proc/$pid file
+ *	@sr: scan ring
+ *	@k: chunk entry index
+ *	@f: file (SCAN_*)
+ *	@pid: task PID number
+ *
+ *	Queues openat -> read -> close chain for /proc/@pid/<@f file>
+ *	using fixed file slot of @k/@f.  Results end up in sr->res[].
+ */
+static void queue_file_read(struct scan_ring *sr, int k, int f, pid_t pid)
+{
+	int slot = k * SCAN_FILES + f;
+	struct io_uring_sqe *sqe;
+	char *buf;
+	int len;
+
+	if (f == SCAN_STAT) {
+		buf = sr->stat[k];
+		len = SCAN_STAT_SIZE;
+	} else {
+		buf = sr->activity[k][f - SCAN_ACTIVITY_TIME];
+		len = SCAN_ACTIVITY_SIZE;
+	}
+
+	sprintf(sr->path[slot], "/proc/%d/%s", pid, scan_files[f]);
+
+	sqe = uring_get_sqe(&sr->ring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)sr->path[slot];
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = slot * SCAN_OPS + SCAN_OPEN;
+
+	/* the slot has to be closed even if the read fails */
+	sqe = uring_get_sqe(&sr->ring);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = slot;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len - 1;
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sqe->user_data = slot * SCAN_OPS + SCAN_READ;
+
+	sqe = uring_get_sqe(&sr->ring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = slot * SCAN_OPS + SCAN_CLOSE;
+}
+
+/**
+ *	run_scan_ring - submit queued reads and collect their results
+ *	@sr: scan ring
+ *	@nr_files: number of queued file reads
+ *
+ *	Returns 0 on success or errno value on failure.
+ */
+static int run_scan_ring(struct scan_ring *sr, int nr_files)
+{
+	struct io_uring_cqe *cqe;
+	int err;
+
+	err = uring_submit_wait(&sr->ring, nr_files * SCAN_OPS);
+	if (err)
+		return err;
+
+	while ((cqe = uring_peek_cqe(&sr->ring))) {
+		int slot = cqe->user_data / SCAN_OPS;
+
+		sr->res[slot][cqe->user_data % SCAN_OPS] = cqe->res;
+		uring_cqe_seen(&sr->ring);
+	}
+
+	return 0;
+}
+
+/**
+ *	get_scan_ring - get scan ring of the calling thread
+ *
+ *	Sets up the ring on the first call and checks that reading
+ *	/proc/$pid/stat with it works.  Returns NULL (and disables
+ *	the io_uring engine) on failure.
+ */
+static struct scan_ring *get_scan_ring(void)
+{
+	struct scan_ring *sr = scan_ring;
+	int err;
+
+	if (sr)
+		return sr;
+
+	sr = calloc(1, sizeof(*sr));
+	if (!sr)
+		pabort("calloc scan_ring");
+
+	err = uring_init(&sr->ring, SCAN_RING_ENTRIES);
+	if (!err)
+		err = uring_register_files(&sr->ring, SCAN_SLOTS);
+	if (!err) {
+		queue_file_read(sr, 0, SCAN_STAT, getpid());
+		err = run_scan_ring(sr, 1);
+	}
+	if (!err && sr->res[SCAN_STAT][SCAN_READ] <= 0)
+		err = -sr->res[SCAN_STAT][SCAN_OPEN] ?: EINVAL;
+
+	if (err) {
+		if (!__atomic_exchange_n(&uring_failed, 1, __ATOMIC_RELAXED))
+			printf("io_uring scanning unavailable (%s), "
+			       "using read()\n", strerror(err));
+		uring_free(&sr->ring);
+		free(sr);
+		return NULL;
+	}
+
+	scan_ring = sr;
+
+	return sr;
+}
+
+/**
+ *	scan_chunk_uring - read task information of a chunk
+ *	@sr: scan ring
+ *	@rs: scan_results[] entries
+ *	@nr: number of entries (at most SCAN_CHUNK)
+ *
+ *	Reads task information like read_task_info() does but using
+ *	a single io_uring submission (cached files in @rs are left
+ *	alone, see store_task()).  Returns 0 on success or errno value
+ *	on failure (@rs are not filled then).
+ */
+static int scan_chunk_uring(struct scan_ring *sr, struct scan_result *rs,
+			    int nr)
+{
+	int nr_files = scan_activity_only ? 1 : SCAN_FILES;
+	int k, f, err;
+
+	for (k = 0; k < nr; k++)
+		for (f = 0; f < nr_files; f++)
+			queue_file_read(sr, k, f, rs[k].pid);
+
+	/* the ring state is unknown after a failure, don't use it again */
+	err = run_scan_ring(sr, nr * nr_files);
+	if (err) {
+		printf("io_uring scanning failed (%s), using read()\n",
+		       strerror(err));
+		__atomic_store_n(&uring_failed, 1, __ATOMIC_RELAXED);
+		return err;
+	}
+
+	for (k = 0; k < nr; k++) {
+		struct scan_result *r = &rs[k];
+		int *stat = sr->res[k * SCAN_FILES + SCAN_STAT];
+		int *atime = sr->res[k * SCAN_FILES + SCAN_ACTIVITY_TIME];
+		int *act = sr->res[k * SCAN_FILES + SCAN_ACTIVITY];
+
+		r->err = EBADF;
+
+		if (stat[SCAN_READ] <= 0 ||
+		    parse_task_stat(sr->stat[k], stat[SCAN_READ], &r->ti))
+			continue;
+
+		/* see get_task_info() */
+		if (scan_activity_only || atime[SCAN_OPEN] == -ENOENT) {
+			r->ti.activity = ACTIVITY_UNKNOWN;
+			r->ti.time = 0;
+			r->err = 0;
+			continue;
+		}
+
+		if (atime[SCAN_READ] <= 0 || act[SCAN_READ] <= 0)
+			continue;
+
+		sr->activity[k][0][atime[SCAN_READ]] = '\0';
+		sr->activity[k][1][act[SCAN_READ]] = '\0';
+		r->ti.time = atoi(sr->activity[k][0]);
+		r->ti.activity = atoi(sr->activity[k][1]);
+		r->err = 0;
+	}
+
+	return 0;
+}
+
+/**
+ *	scan_chunks - read task information of scan_results[]
+ *
+ *	Claims SCAN_CHUNK entries of scan_results[] at a time (until
+ *	all of them are claimed) and reads their task information
+ *	(using io_uring if scan_uring is set).  Run by all scan
+ *	workers in parallel.
+ */
+static void scan_chunks(void)
+{
+	struct scan_ring *sr;
+	int k, end;
+
+	while ((k = __atomic_fetch_add(&scan_next, SCAN_CHUNK,
+				       __ATOMIC_RELAXED)) < nr_scan_results) {
+		end = k + SCAN_CHUNK;
+		if (end > nr_scan_results)
+			end = nr_scan_results;
+
+		if (scan_uring &&
+		    !__atomic_load_n(&uring_failed, __ATOMIC_RELAXED) &&
+		    (sr = get_scan_ring()) &&
+		    !scan_chunk_uring(sr, &scan_results[k], end - k))
+			continue;
+
+		for (; k < end; k++)
+			scan_task(&scan_results[k]);
+	}
+}
+
+static void *scan_worker(void *arg)
+{
+	while (1) {
+		pthread_barrier_wait(&scan_start);
+		scan_chunks();
+		pthread_barrier_wait(&scan_done);
+	}
+
+	return NULL;
+}
+
+/**
+ *	start_scan_workers - start full rescan worker threads
+ *
+ *	Starts scan_workers - 1 worker threads (the scanning thread
+ *	itself is the last worker).  Workers block all signals.
+ */
+static void start_scan_workers(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t mask, old;
+	int i;
+
+	if (pthread_barrier_init(&scan_start, NULL, scan_workers) ||
+	    pthread_barrier_init(&scan_done, NULL, scan_workers))
+		pabort("pthread_barrier_init");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SCANNER_STACK_SIZE);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+
+	for (i = 1; i < scan_workers; i++)
+		if (pthread_create(&thread, &attr, scan_worker, NULL))
+			pabort("pthread_create scan worker");
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+
+	workers_started = 1;
+}
+
+/**
+ *	merge_scan_results - merge full rescan results into task_table[]
+ *
+ *	Stores scan_results[] (see store_task()) and removes tasks
+ *	which are gone.  Entries whose cached files are still held by
+ *	a result are marked as seen by this rescan first so caching
+ *	files of other tasks can't evict (and close) them before their
+ *	result is merged.
+ */
+static void merge_scan_results(void)
+{
+	int i, k;
+
+	scan_gen++;
+
+	for (k = 0; k < nr_scan_results; k++) {
+		struct scan_result *r = &scan_results[k];
+
+		i = pidhash_lookup(&task_index, r->pid);
+		if (i >= 0 && r->fd[0] >= 0 && task_fds[i].fd[0] == r->fd[0])
+			task_seen[i] = scan_gen;
+	}
+
+	for (k = 0; k < nr_scan_results; k++) {
+		struct scan_result *r = &scan_results[k];
+
+		i = store_task(r);
+		if (i < 0)
+			continue;
+
+		task_seen[i] = scan_gen;
+		if (scan_verbose)
+			printf("%d %d %u\n", r->pid, task_table[i].activity,
+			       (unsigned)task_table[i].time);
+	}
+
+	/* del_task() moves the last entry so walk backwards */
+	for (i = nr_tasks - 1; i >= 0; i--)
+		if (task_seen[i] != scan_gen)
+			del_task(i);
+}
+
+/**
+ *	update_tasks - update tasklist task list
+ *
+ *	Refresh task_table[] for all tasks in the system using
+ *	information from /proc/$pid/stat and /proc/$pid/activity[_time]
+ *	(see read_task_info()), remove tasks which are gone and then
+ *	publish it in tasklist task list.  Entries are updated in
+ *	place so activity reported through the activity socket is
+ *	kept.
+ *
+ *	The /proc listing is collected first and task information is
+ *	then read by scan_workers threads in parallel (see
+ *	scan_chunks()), each into its own scan_results[] entries.  The
+ *	results are merged into task_table[] by the calling thread (see
+ *	merge_scan_results()).
+ */
+static void update_tasks(void)
+{
+	DIR *dir;
+	struct dirent *de;
+
+	dir = opendir("/proc");
+	if (!dir)
+		pabort("opendir proc");
+
+	nr_scan_results = 0;
+
+	while ((de = readdir(dir))) {
+		const char *dname = de->d_name;
+
+		/* skip init and non-PID entries (i.e. self, thread-self) */
+		if (!strcmp(dname, "1") || !isdigit(dname[0]))
+			continue;
+
+		if (nr_scan_results == scan_results_size) {
+			scan_results_size = scan_results_size ?
+					    scan_results_size * 2 :
+					    TASKLIST_INIT_TASKS;
+			scan_results = realloc(scan_results,
+					       scan_results_size *
+					       sizeof(*scan_results));
+			if (!scan_results)
+				pabort("realloc scan_results");
+		}
+
+		prepare_scan(&scan_results[nr_scan_results++], atoi(dname));
+	}
+
+	closedir(dir);
+
+	if (scan_workers > 1 && !workers_started)
+		start_scan_workers();
+
+	scan_next = 0;
+	if (scan_workers > 1)
+		pthread_barrier_wait(&scan_start);
+	scan_chunks();
+	if (scan_workers > 1)
+		pthread_barrier_wait(&scan_done);
+
+	merge_scan_results();
+	publish_tasks();
+}
+
+/**
+ *	process_activity - process pending activity reports
+ *
+ *	Reads all pending activity reports (see activity.h) and applies
+ *	them to task_table[].  Tasks not known yet are added first.
+ *	Activity time is updated only when the activity changes.
+ *	Returns 1 if task_table[] may have changed, 0 otherwise.
+ */
+static int process_activity(void)
+{
+	struct activity_msg msgs[ACTIVITY_MAX_MSGS];
+	int changed = 0;
+	int nr, i, j;
+
+	while ((nr = activity_recv(activity_fd, msgs)) >= 0) {
+		for (j = 0; j < nr; j++) {
+			int activity = !!msgs[j].activity;
+
+			i = pidhash_lookup(&task_index, msgs[j].pid);
+			if (i < 0)
+				i = update_task(msgs[j].pid);
+			if (i < 0 || task_table[i].activity == activity)
+				continue;
+
+			task_table[i].activity = activity;
+			task_table[i].time = time(NULL);
+			changed = 1;
+		}
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		pabort("recv activity");
+
+	return changed;
+}
+
+/**
+ *	proc_events_open - open proc connector socket
+ *
+ *	Opens netlink connector socket and subscribes to process
+ *	events (fork/exec/exit notifications).  Requires
+ *	CAP_NET_ADMIN capability.  Returns socket file descriptor.
+ */
+static int proc_events_open(void)
+{
+	struct sockaddr_nl sa;
+	struct __attribute__((aligned(NLMSG_ALIGNTO))) {
+		struct nlmsghdr nlh;
+		struct __attribute__((__packed__)) {
+			struct cn_msg cn;
+			enum proc_cn_mcast_op op;
+		};
+	} req;
+	int nl_fd;
+
+	nl_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (nl_fd < 0)
+		pabort("socket netlink");
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	sa.nl_pid = getpid();
+
+	if (bind(nl_fd, (struct sockaddr *)&sa, sizeof(sa)))
+		pabort("bind netlink");
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_pid = getpid();
+	req.nlh.nlmsg_type = NLMSG_DONE;
+	req.cn.id.idx = CN_IDX_PROC;
+	req.cn.id.val = CN_VAL_PROC;
+	req.cn.len = sizeof(enum proc_cn_mcast_op);
+	req.op = PROC_CN_MCAST_LISTEN;
+
+	if (send(nl_fd, &req, sizeof(req), 0) != sizeof(req))
+		pabort("send netlink");
+
+	return nl_fd;
+}
+
+/**
+ *	handle_proc_event - handle a single proc connector event
+ *	@ev: process event
+ *
+ *	Adds new processes to task_table[] on fork, refreshes them
+ *	on exec and removes them on exit.  Thread events are ignored.
+ *	Returns 1 if task_table[] may have changed, 0 otherwise.
+ */
+static int handle_proc_event(struct proc_event *ev)
+{
+	switch (ev->what) {
+	case PROC_EVENT_FORK:
+		if (ev->event_data.fork.child_pid !=
+		    ev->event_data.fork.child_tgid)
+			return 0;
+		update_task(ev->event_data.fork.child_tgid);
+		return 1;
+	case PROC_EVENT_EXEC:
+		update_task(ev->event_data.exec.process_tgid);
+		return 1;
+	case PROC_EVENT_EXIT:
+		if (ev->event_data.exit.process_pid !=
+		    ev->event_data.exit.process_tgid)
+			return 0;
+		remove_task(ev->event_data.exit.process_tgid);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ *	process_proc_events - process pending proc connector events
+ *	@nl_fd: proc connector socket
+ *
+ *	Reads all pending messages from @nl_fd and applies them to
+ *	task_table[].  Returns 1 if task_table[] may have changed,
+ *	0 if not and -1 if events were lost (full rescan is needed).
+ */
+static int process_proc_events(int nl_fd)
+{
+	char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	int changed = 0;
+
+	while (1) {
+		struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+		ssize_t sz;
+
+		sz = recv(nl_fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (sz < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == ENOBUFS)
+				return -1;
+			if (errno == EINTR)
+				continue;
+			pabort("recv netlink");
+		}
+
+		for (; NLMSG_OK(nlh, sz); nlh = NLMSG_NEXT(nlh, sz)) {
+			struct cn_msg *cn;
+
+			if (nlh->nlmsg_type == NLMSG_NOOP)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_ERROR ||
+			    nlh->nlmsg_type == NLMSG_OVERRUN)
+				return -1;
+
+			cn = NLMSG_DATA(nlh);
+			if (cn->id.idx != CN_IDX_PROC ||
+			    cn->id.val != CN_VAL_PROC)
+				continue;
+
+			changed |= handle_proc_event((struct proc_event *)cn->data);
+		}
+	}
+
+	return changed;
+}
+
+/**
+ *	scanner_loop - maintain task list
+ *
+ *	Keeps task_table[] up to date and publishes it to the task list
+ *	passed to scanner_init() after each batch of changes.  Activity
+ *	reports are applied as soon as they arrive.  Without proc
+ *	connector events /proc is rescanned every second.  With them
+ *	task_table[] follows fork/exec/exit events and a full rescan is
+ *	done every scan_rescan_interval seconds (and whenever events
+ *	were lost) to catch changes not covered by the events (i.e.
+ *	activity changes through /proc/$pid/activity files).  Never
+ *	returns.
+ */
+void scanner_loop(void)
+{
+	struct pollfd pfds[2];
+	time_t next_rescan = 0;
+	int interval = scan_netlink ? scan_rescan_interval : 1;
+
+	pfds[0].fd = activity_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = scan_netlink ? proc_events_open() : -1;
+	pfds[1].events = POLLIN;
+
+	while (1) {
+		time_t t = time(NULL);
+		int changed = 0;
+		int ret;
+
+		if (t >= next_rescan) {
+			update_tasks();
+			next_rescan = t + interval;
+		}
+
+		ret = poll(pfds, 2, (next_rescan - t) * 1000);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			pabort("poll");
+		}
+		if (!ret)
+			continue;
+
+		if (pfds[0].revents)
+			changed |= process_activity();
+
+		if (pfds[1].revents) {
+			ret = process_proc_events(pfds[1].fd);
+			if (ret < 0)
+				next_rescan = 0;
+			else
+				changed |= ret;
+		}
+
+		if (changed)
+			publish_tasks();
+	}
+}
+
+/**
+ *	scanner_init - init task list scanner
+ *	@tl: task list to publish (created by tasklist_create())
+ *
+ *	Opens the activity reporting socket and publishes the first
+ *	task list snapshot (so readers can rely on it once this
+ *	returns).
+ */
+void scanner_init(struct tasklist *tl)
+{
+	tasklist = tl;
+
+	init_fd_cache();
+
+	activity_fd = activity_open();
+	if (activity_fd < 0)
+		pabort("activity socket");
+
+	update_tasks();
+}
+
+static void *scanner_thread(void *arg)
+{
+	scanner_loop();
+
+	return NULL;
+}
+
+/**
+ *	scanner_start - start task list scanner thread
+ *	@tl: task list to publish (created by tasklist_create())
+ *
+ *	Initializes the scanner (see scanner_init()) and runs it in a
+ *	new thread of the calling process.  The thread blocks all
+ *	signals so they are handled by the main thread.
+ */
+void scanner_start(struct tasklist *tl)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t mask, old;
+
+	scanner_init(tl);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SCANNER_STACK_SIZE);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+
+	if (pthread_create(&thread, &attr, scanner_thread, NULL))
+		pabort("pthread_create scanner");
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+}
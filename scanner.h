@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_SCANNER_H
+#define __TBULMKD_SCANNER_H
+
+#include "shm.h"
+
+/*
+ * Task list scanner: keeps a task list (see shm.h) up to date using
+ * /proc, proc connector events and activity reports.  It is run by
+ * proxy_shm or as a thread of tbulmkd (-s).
+ */
+extern int scan_netlink;	/* use proc connector events */
+extern int scan_activity_only;	/* take activity only from reports */
+extern int scan_rescan_interval; /* full rescan interval (secs) */
+extern int scan_verbose;	/* print tasks found by full rescans */
+extern int scan_workers;	/* full rescan worker threads */
+extern int scan_uring;		/* read /proc with io_uring if possible */
+
+void scanner_init(struct tasklist *tl);
+void scanner_loop(void);
+void scanner_start(struct tasklist *tl);
+
+#endif
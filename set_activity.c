@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "activity.h"
+
+/*
+ * Reports activity of tasks to proxy_shm (see activity.h), i.e.
+ * "set_activity 1234 bg 1250 fg".
+ */
+int main(int argc, char *argv[])
+{
+	struct activity_msg msgs[ACTIVITY_MAX_MSGS];
+	int nr = 0;
+	int i, ret;
+
+	if (argc < 3 || !(argc & 1) || argc > 2 * ACTIVITY_MAX_MSGS + 1) {
+		printf("Usage: %s <pid> <fg|bg> [<pid> <fg|bg>]...\n",
+		       argv[0]);
+		return 1;
+	}
+
+	for (i = 1; i < argc; i += 2) {
+		msgs[nr].pid = atoi(argv[i]);
+		if (!strcmp(argv[i + 1], "fg") || !strcmp(argv[i + 1], "1"))
+			msgs[nr].activity = 1;
+		else if (!strcmp(argv[i + 1], "bg") ||
+			 !strcmp(argv[i + 1], "0"))
+			msgs[nr].activity = 0;
+		else {
+			printf("invalid activity %s\n", argv[i + 1]);
+			return 1;
+		}
+		nr++;
+	}
+
+	ret = activity_report_many(msgs, nr);
+	if (ret) {
+		printf("activity_report: %s\n", strerror(ret));
+		return 1;
+	}
+
+	return 0;
+}
@@ -15,21 +15,119 @@
 #ifndef __TBULMKD_SHM_H
 #define __TBULMKD_SHM_H
 
-#include <semaphore.h>
+#include <sys/types.h>
 #include <time.h>
+#include "common.h"
 
-#define MAX_NR_TASKS 1000
+#define TASKLIST_SHM_NAME	"/tbulmkd_tasklist"
+#define TASKLIST_MAGIC		0x74626c6b	/* "tblk" */
+#define TASKLIST_VERSION	3
+
+/*
+ * Abstract unix datagram socket address tasklist_publish() sends an
+ * (empty) notification to after publishing a new snapshot.
+ */
+#define TASKLIST_NOTIFY_NAME	"tbulmkd_tasklist"
+
+/* initial number of task entries in each buffer */
+#define TASKLIST_INIT_TASKS	1024
 
 struct task_info_shm {
 	pid_t pid;
 	time_t time; /* last update to activity */
 	int activity; /* 1 == foreground, 0 == background */
 	int tty_nr;
+	unsigned long rss; /* in bytes */
+	unsigned long long start_time; /* in clock ticks after boot */
+	char name[TASK_COMM_LEN];
+};
+
+/*
+ * Each buffer holds task entries in columns (struct of arrays) so
+ * readers interested in a few fields touch only their cache lines.
+ * Columns are TASKLIST_ALIGN aligned and follow each other in the
+ * TASKLIST_COL_* order, their offsets depend only on the buffer
+ * capacity.  Activity is a packed bitmap (1 == foreground) and so
+ * are changed rows: row i is marked changed unless it is the same
+ * as row i of the previous snapshot.
+ */
+enum {
+	TASKLIST_COL_PID,		/* pid_t */
+	TASKLIST_COL_TIME,		/* time_t */
+	TASKLIST_COL_ACTIVITY,		/* unsigned long bitmap */
+	TASKLIST_COL_TTY_NR,		/* int */
+	TASKLIST_COL_RSS,		/* unsigned long */
+	TASKLIST_COL_START_TIME,	/* unsigned long long */
+	TASKLIST_COL_NAME,		/* char[TASK_COMM_LEN] */
+	TASKLIST_COL_CHANGED,		/* unsigned long bitmap */
+	TASKLIST_COLS,
+};
+
+#define TASKLIST_ALIGN		64
+
+/*
+ * Task list is double-buffered: proxy_shm writes a complete snapshot
+ * to the inactive buffer and then publishes it by incrementing gen
+ * (bufs[gen & 1] is the current one).  Each buffer has its own
+ * sequence counter (odd while the buffer is being written) so readers
+ * can detect that the buffer they were copying got reused.  Readers
+ * never block the writer and the writer never waits for readers.
+ *
+ * Task columns of each buffer live at @offset bytes from the start of
+ * the shared memory object.  When a buffer has to grow the writer
+ * extends the object, places the buffer at its (old) end and updates
+ * @size so readers know they have to remap it.
+ */
+struct tasklist_buf {
+	unsigned int seq;
+	int nr_tasks;
+	int capacity;
+	unsigned long offset;
 };
 
 struct tasklist_mem {
-	sem_t sem;
-	struct task_info_shm tasks[MAX_NR_TASKS];
+	unsigned int magic;
+	unsigned int version;
+	unsigned int nr_cols; /* TASKLIST_COLS */
+	unsigned int gen;
+	unsigned long size; /* size of shared memory object */
+	struct tasklist_buf bufs[2];
+};
+
+struct tasklist {
+	int fd;
+	int notify_fd; /* writer only, -1 for readers */
+	struct tasklist_mem *mem;
+	size_t size; /* size of the mapping */
+	unsigned long *changed; /* writer only, changed rows bitmap */
+	int changed_size; /* in longs */
 };
 
+/*
+ * Private task list snapshot (see tasklist_snapshot()).  If it
+ * directly follows the previous one only rows changed since then
+ * are copied, the other ones are the same as before.
+ */
+struct tasklist_snap {
+	unsigned int gen; /* snapshot generation */
+	int valid; /* @gen is valid */
+	int full; /* all rows were copied */
+	int nr_tasks; /* number of rows */
+	int nr_changed; /* number of copied rows */
+	int *rows; /* row indexes of copied rows */
+	struct task_info_shm *tasks; /* copied rows */
+	int size; /* number of entries in @rows and @tasks */
+};
+
+struct tasklist *tasklist_create(const char *name);
+struct tasklist *tasklist_open(const char *name);
+struct tasklist *tasklist_reader(struct tasklist *tl);
+void tasklist_close(struct tasklist *tl);
+int tasklist_publish(struct tasklist *tl,
+		     const struct task_info_shm *tasks, int nr_tasks);
+unsigned int tasklist_gen(struct tasklist *tl);
+int tasklist_snapshot(struct tasklist *tl, struct tasklist_snap *snap);
+int tasklist_notify_open(void);
+int tasklist_notify_read(int fd);
+
 #endif
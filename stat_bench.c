@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * parse_stat() microbenchmark.
+ *
+ * Usage: stat_bench [corpus file] [seconds]
+ *
+ * The corpus file contains one /proc/$pid/stat line per line (i.e.
+ * created with 'cat /proc/[0-9]*\/stat > corpus').  Without it stat
+ * lines of the currently running tasks are used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include "common.h"
+
+struct stat_line {
+	char *s;
+	size_t len;
+};
+
+static struct stat_line *lines;
+static int nr_lines;
+
+static void add_line(const char *s, size_t len)
+{
+	static int size;
+
+	while (len && s[len - 1] == '\n')
+		len--;
+	if (!len)
+		return;
+
+	if (nr_lines == size) {
+		size = size ? size * 2 : 256;
+		lines = realloc(lines, size * sizeof(*lines));
+		if (!lines)
+			pabort("realloc lines");
+	}
+
+	lines[nr_lines].s = malloc(len + 1);
+	if (!lines[nr_lines].s)
+		pabort("malloc line");
+	memcpy(lines[nr_lines].s, s, len);
+	/* stat files end with a newline */
+	lines[nr_lines].s[len] = '\n';
+	lines[nr_lines].len = len + 1;
+	nr_lines++;
+}
+
+static void load_corpus(const char *name)
+{
+	FILE *f;
+	char buf[4096];
+
+	f = fopen(name, "r");
+	if (!f)
+		pabort("fopen corpus");
+
+	while (fgets(buf, sizeof(buf), f))
+		add_line(buf, strlen(buf));
+
+	fclose(f);
+}
+
+static void load_proc(void)
+{
+	DIR *dir;
+	struct dirent *de;
+
+	dir = opendir("/proc");
+	if (!dir)
+		pabort("opendir proc");
+
+	while ((de = readdir(dir))) {
+		char buf[4096];
+		FILE *f;
+
+		if (!isdigit(de->d_name[0]))
+			continue;
+
+		snprintf(buf, sizeof(buf), "/proc/%s/stat", de->d_name);
+		f = fopen(buf, "r");
+		if (!f)
+			continue;
+		if (fgets(buf, sizeof(buf), f))
+			add_line(buf, strlen(buf));
+		fclose(f);
+	}
+
+	closedir(dir);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		pabort("clock_gettime");
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	double secs = 2, start, elapsed;
+	unsigned long long parses = 0, sum = 0;
+	int errors = 0;
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "-"))
+		load_corpus(argv[1]);
+	else
+		load_proc();
+	if (argc > 2)
+		secs = atof(argv[2]);
+
+	if (!nr_lines) {
+		fprintf(stderr, "empty corpus\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_lines; i++) {
+		struct task_info ti;
+
+		if (parse_stat(lines[i].s, lines[i].len, &ti))
+			errors++;
+	}
+
+	start = now();
+	do {
+		/* check the time every 1024 parses */
+		for (i = 0; i < 1024; i++) {
+			struct stat_line *l = &lines[parses++ % nr_lines];
+			struct task_info ti;
+
+			if (!parse_stat(l->s, l->len, &ti))
+				sum += ti.rss + ti.tty_nr + ti.start_time;
+		}
+		elapsed = now() - start;
+	} while (elapsed < secs);
+
+	printf("%d lines (%d unparsable), %llu parses in %.2f s: "
+	       "%.0f parses/s, %.1f ns/parse (checksum %llu)\n",
+	       nr_lines, errors, parses, elapsed, parses / elapsed,
+	       elapsed * 1e9 / parses, sum);
+
+	return 0;
+}
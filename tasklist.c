@@ -0,0 +1,624 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include "common.h"
+#include "shm.h"
+
+#define load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p)		__atomic_load_n(p, __ATOMIC_RELAXED)
+#define store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define store_relaxed(p, v)	__atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+#define tasklist_align(x)	(((x) + TASKLIST_ALIGN - 1) & ~(TASKLIST_ALIGN - 1))
+
+#define BITS_PER_LONG		(8 * sizeof(unsigned long))
+#define bitmap_longs(nr)	(((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+/* per-entry sizes of task list columns (bitmaps have 0) */
+static const size_t col_sizes[TASKLIST_COLS] = {
+	[TASKLIST_COL_PID]		= sizeof(pid_t),
+	[TASKLIST_COL_TIME]		= sizeof(time_t),
+	[TASKLIST_COL_TTY_NR]		= sizeof(int),
+	[TASKLIST_COL_RSS]		= sizeof(unsigned long),
+	[TASKLIST_COL_START_TIME]	= sizeof(unsigned long long),
+	[TASKLIST_COL_NAME]		= TASK_COMM_LEN,
+};
+
+/* task list buffer columns */
+struct tasklist_cols {
+	pid_t *pid;
+	time_t *time;
+	unsigned long *activity;
+	int *tty_nr;
+	unsigned long *rss;
+	unsigned long long *start_time;
+	char (*name)[TASK_COMM_LEN];
+	unsigned long *changed;
+};
+
+/**
+ *	tasklist_col_offset - get task list column offset
+ *	@col: column (TASKLIST_COL_*)
+ *	@capacity: buffer capacity
+ *
+ *	Returns offset of @col from the start of a buffer with
+ *	@capacity entries (TASKLIST_COLS gives the buffer size).
+ */
+static size_t tasklist_col_offset(int col, int capacity)
+{
+	size_t offset = 0;
+	int i;
+
+	for (i = 0; i < col; i++) {
+		if (!col_sizes[i])
+			offset += bitmap_longs(capacity) * sizeof(unsigned long);
+		else
+			offset += capacity * col_sizes[i];
+		offset = tasklist_align(offset);
+	}
+
+	return offset;
+}
+
+/**
+ *	tasklist_get_cols - get task list buffer columns
+ *	@tl: task list
+ *	@offset: buffer offset
+ *	@capacity: buffer capacity
+ *	@c: returned columns
+ */
+static void tasklist_get_cols(struct tasklist *tl, unsigned long offset,
+			      int capacity, struct tasklist_cols *c)
+{
+	char *buf = (char *)tl->mem + offset;
+
+	c->pid = (void *)(buf + tasklist_col_offset(TASKLIST_COL_PID,
+						     capacity));
+	c->time = (void *)(buf + tasklist_col_offset(TASKLIST_COL_TIME,
+						      capacity));
+	c->activity = (void *)(buf + tasklist_col_offset(TASKLIST_COL_ACTIVITY,
+							  capacity));
+	c->tty_nr = (void *)(buf + tasklist_col_offset(TASKLIST_COL_TTY_NR,
+							capacity));
+	c->rss = (void *)(buf + tasklist_col_offset(TASKLIST_COL_RSS,
+						     capacity));
+	c->start_time = (void *)(buf +
+			tasklist_col_offset(TASKLIST_COL_START_TIME, capacity));
+	c->name = (void *)(buf + tasklist_col_offset(TASKLIST_COL_NAME,
+						      capacity));
+	c->changed = (void *)(buf + tasklist_col_offset(TASKLIST_COL_CHANGED,
+							 capacity));
+}
+
+static inline int cols_activity(struct tasklist_cols *c, int i)
+{
+	return (c->activity[i / BITS_PER_LONG] >> (i % BITS_PER_LONG)) & 1;
+}
+
+/**
+ *	cols_row_equal - compare task list buffer row with task entry
+ *	@c: buffer columns
+ *	@i: row index
+ *	@tis: task entry
+ */
+static int cols_row_equal(struct tasklist_cols *c, int i,
+			  const struct task_info_shm *tis)
+{
+	return c->pid[i] == tis->pid && c->time[i] == tis->time &&
+	       cols_activity(c, i) == !!tis->activity &&
+	       c->tty_nr[i] == tis->tty_nr && c->rss[i] == tis->rss &&
+	       c->start_time[i] == tis->start_time &&
+	       !memcmp(c->name[i], tis->name, TASK_COMM_LEN);
+}
+
+/**
+ *	tasklist_diff - find task entries changed since the last snapshot
+ *	@tl: task list
+ *	@tasks: task entries
+ *	@nr_tasks: number of task entries
+ *
+ *	Sets bits of @tl changed rows bitmap for @tasks entries which
+ *	differ from the same rows of the current buffer (or aren't
+ *	there at all).  Returns number of changed rows.
+ */
+static int tasklist_diff(struct tasklist *tl,
+			 const struct task_info_shm *tasks, int nr_tasks)
+{
+	struct tasklist_buf *buf = &tl->mem->bufs[tl->mem->gen & 1];
+	int old_nr = tl->mem->gen ? buf->nr_tasks : 0;
+	int longs = bitmap_longs(nr_tasks);
+	struct tasklist_cols c;
+	int i, nr = 0;
+
+	if (longs > tl->changed_size) {
+		tl->changed = realloc(tl->changed, longs * sizeof(long));
+		if (!tl->changed)
+			pabort("realloc tasklist changed");
+		tl->changed_size = longs;
+	}
+	memset(tl->changed, 0, longs * sizeof(long));
+
+	tasklist_get_cols(tl, buf->offset, buf->capacity, &c);
+
+	for (i = 0; i < nr_tasks; i++) {
+		if (i < old_nr && cols_row_equal(&c, i, &tasks[i]))
+			continue;
+
+		tl->changed[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+		nr++;
+	}
+
+	return nr;
+}
+
+/**
+ *	cols_store - store task entries to task list buffer
+ *	@c: buffer columns
+ *	@tasks: task entries
+ *	@nr_tasks: number of task entries
+ */
+static void cols_store(struct tasklist_cols *c,
+		       const struct task_info_shm *tasks, int nr_tasks)
+{
+	int i;
+
+	memset(c->activity, 0, bitmap_longs(nr_tasks) * sizeof(unsigned long));
+
+	for (i = 0; i < nr_tasks; i++) {
+		const struct task_info_shm *tis = &tasks[i];
+
+		c->pid[i] = tis->pid;
+		c->time[i] = tis->time;
+		if (tis->activity)
+			c->activity[i / BITS_PER_LONG] |=
+				1UL << (i % BITS_PER_LONG);
+		c->tty_nr[i] = tis->tty_nr;
+		c->rss[i] = tis->rss;
+		c->start_time[i] = tis->start_time;
+		memcpy(c->name[i], tis->name, TASK_COMM_LEN);
+	}
+}
+
+/**
+ *	cols_load_row - load task entry from task list buffer
+ *	@c: buffer columns
+ *	@i: row index
+ *	@tis: task entry
+ */
+static void cols_load_row(struct tasklist_cols *c, int i,
+			  struct task_info_shm *tis)
+{
+	tis->pid = c->pid[i];
+	tis->time = c->time[i];
+	tis->activity = cols_activity(c, i);
+	tis->tty_nr = c->tty_nr[i];
+	tis->rss = c->rss[i];
+	tis->start_time = c->start_time[i];
+	memcpy(tis->name, c->name[i], TASK_COMM_LEN);
+	tis->name[TASK_COMM_LEN - 1] = 0;
+}
+
+/**
+ *	tasklist_map - (re)map shared task list
+ *	@tl: task list
+ *	@size: new mapping size
+ *	@prot: mapping protection
+ *
+ *	Replaces the current mapping of @tl with a @size bytes one.
+ */
+static void tasklist_map(struct tasklist *tl, size_t size, int prot)
+{
+	if (tl->mem)
+		munmap(tl->mem, tl->size);
+
+	tl->mem = mmap(NULL, size, prot, MAP_SHARED | MAP_LOCKED, tl->fd, 0);
+	if (tl->mem == MAP_FAILED)
+		pabort("mmap tasklist");
+
+	tl->size = size;
+}
+
+/**
+ *	tasklist_notify_addr - get task list notification socket address
+ *	@sa: returned socket address
+ *
+ *	Returns length of the TASKLIST_NOTIFY_NAME abstract socket
+ *	address.
+ */
+static socklen_t tasklist_notify_addr(struct sockaddr_un *sa)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	memcpy(sa->sun_path + 1, TASKLIST_NOTIFY_NAME,
+	       sizeof(TASKLIST_NOTIFY_NAME) - 1);
+
+	return offsetof(struct sockaddr_un, sun_path) +
+	       sizeof(TASKLIST_NOTIFY_NAME);
+}
+
+/**
+ *	tasklist_create - create shared task list
+ *	@name: shared memory object name (or NULL)
+ *
+ *	Creates @name shared memory object (removing the old one
+ *	first) with initial capacity of TASKLIST_INIT_TASKS entries
+ *	for each buffer and maps it for writing.  If @name is NULL an
+ *	anonymous memfd is used instead (the task list can only be
+ *	read within the process then, see tasklist_reader()).  It also
+ *	opens the socket used for sending notifications about new
+ *	snapshots.
+ */
+struct tasklist *tasklist_create(const char *name)
+{
+	struct tasklist *tl;
+	struct tasklist_mem *tm;
+	size_t hdr = tasklist_align(sizeof(struct tasklist_mem));
+	size_t bsz = tasklist_col_offset(TASKLIST_COLS, TASKLIST_INIT_TASKS);
+
+	tl = calloc(1, sizeof(*tl));
+	if (!tl)
+		pabort("calloc tasklist");
+
+	tl->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK |
+			       SOCK_CLOEXEC, 0);
+	if (tl->notify_fd < 0)
+		pabort("socket tasklist notify");
+
+	if (name) {
+		shm_unlink(name);
+		tl->fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	} else {
+		tl->fd = memfd_create("tbulmkd_tasklist", MFD_CLOEXEC);
+	}
+	if (tl->fd < 0)
+		pabort("shm_open tasklist");
+
+	if (ftruncate(tl->fd, hdr + 2 * bsz))
+		pabort("ftruncate");
+
+	tasklist_map(tl, hdr + 2 * bsz, PROT_READ | PROT_WRITE);
+
+	tm = tl->mem;
+	tm->version = TASKLIST_VERSION;
+	tm->nr_cols = TASKLIST_COLS;
+	tm->size = tl->size;
+	tm->bufs[0].capacity = TASKLIST_INIT_TASKS;
+	tm->bufs[0].offset = hdr;
+	tm->bufs[1].capacity = TASKLIST_INIT_TASKS;
+	tm->bufs[1].offset = hdr + bsz;
+	store_release(&tm->magic, TASKLIST_MAGIC);
+
+	return tl;
+}
+
+/**
+ *	tasklist_open_fd - open task list
+ *	@fd: task list memory object file descriptor (taken over)
+ *
+ *	Maps @fd read-only.  Aborts if the task list layout doesn't
+ *	match.
+ */
+static struct tasklist *tasklist_open_fd(int fd)
+{
+	struct tasklist *tl;
+	struct stat st;
+
+	tl = calloc(1, sizeof(*tl));
+	if (!tl)
+		pabort("calloc tasklist");
+
+	tl->notify_fd = -1;
+	tl->fd = fd;
+
+	if (fstat(tl->fd, &st))
+		pabort("fstat tasklist");
+
+	if (st.st_size < sizeof(struct tasklist_mem))
+		pabort("tasklist size");
+
+	tasklist_map(tl, st.st_size, PROT_READ);
+
+	if (load_acquire(&tl->mem->magic) != TASKLIST_MAGIC ||
+	    tl->mem->version != TASKLIST_VERSION ||
+	    tl->mem->nr_cols != TASKLIST_COLS)
+		pabort("tasklist version");
+
+	return tl;
+}
+
+/**
+ *	tasklist_open - open shared task list
+ *	@name: shared memory object name
+ *
+ *	Opens @name shared memory object created by tasklist_create()
+ *	and maps it read-only (see tasklist_open_fd()).
+ */
+struct tasklist *tasklist_open(const char *name)
+{
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0600);
+	if (fd < 0)
+		pabort("shm_open tasklist");
+
+	return tasklist_open_fd(fd);
+}
+
+/**
+ *	tasklist_reader - open task list for reading
+ *	@tl: task list created by tasklist_create()
+ *
+ *	Opens the same task list as @tl (in the same process, i.e. for
+ *	a scanner thread publishing @tl) for reading.  The returned
+ *	task list is independent from @tl and can be used from another
+ *	thread.
+ */
+struct tasklist *tasklist_reader(struct tasklist *tl)
+{
+	int fd;
+
+	fd = fcntl(tl->fd, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		pabort("dup tasklist");
+
+	return tasklist_open_fd(fd);
+}
+
+/**
+ *	tasklist_close - close shared task list
+ *	@tl: task list
+ */
+void tasklist_close(struct tasklist *tl)
+{
+	munmap(tl->mem, tl->size);
+	close(tl->fd);
+	if (tl->notify_fd >= 0)
+		close(tl->notify_fd);
+	free(tl->changed);
+	free(tl);
+}
+
+/**
+ *	tasklist_grow - grow task list buffer
+ *	@tl: task list
+ *	@idx: buffer index (not the current one)
+ *	@nr_tasks: needed number of task entries
+ *
+ *	Extends the shared memory object and moves @idx buffer to its
+ *	end with capacity for at least @nr_tasks entries.  Must be
+ *	called while the buffer sequence counter is odd.
+ */
+static void tasklist_grow(struct tasklist *tl, int idx, int nr_tasks)
+{
+	struct tasklist_buf *buf;
+	int capacity = tl->mem->bufs[idx].capacity * 2;
+	size_t offset = tl->size;
+	size_t size;
+
+	if (capacity < nr_tasks)
+		capacity = nr_tasks;
+
+	size = offset + tasklist_col_offset(TASKLIST_COLS, capacity);
+
+	if (ftruncate(tl->fd, size))
+		pabort("ftruncate");
+
+	tasklist_map(tl, size, PROT_READ | PROT_WRITE);
+
+	buf = &tl->mem->bufs[idx];
+	store_release(&tl->mem->size, size);
+	buf->capacity = capacity;
+	buf->offset = offset;
+}
+
+/**
+ *	tasklist_publish - publish a new task list snapshot
+ *	@tl: task list
+ *	@tasks: task entries
+ *	@nr_tasks: number of task entries
+ *
+ *	Stores @nr_tasks entries from @tasks to the columns of the
+ *	inactive buffer of @tl (growing it if needed) together with
+ *	the rows changed since the current snapshot (see
+ *	tasklist_diff()) and then makes it the current one.
+ *	Readers listening on the notification socket (see
+ *	tasklist_notify_open()) are notified about the new snapshot.
+ *	Nothing is done if @tasks are the same as the current snapshot.
+ *	There must be only one writer.  Returns 1 if a new snapshot was
+ *	published, 0 otherwise.
+ */
+int tasklist_publish(struct tasklist *tl,
+		     const struct task_info_shm *tasks, int nr_tasks)
+{
+	unsigned int gen = load_relaxed(&tl->mem->gen);
+	int idx = (gen + 1) & 1;
+	unsigned int seq = load_relaxed(&tl->mem->bufs[idx].seq);
+	struct tasklist_buf *buf = &tl->mem->bufs[gen & 1];
+	struct tasklist_cols c;
+	struct sockaddr_un sa;
+	socklen_t len;
+	int nr_changed;
+
+	/* the current buffer is only ever written by us */
+	nr_changed = tasklist_diff(tl, tasks, nr_tasks);
+	if (gen && buf->nr_tasks == nr_tasks && !nr_changed)
+		return 0;
+
+	store_relaxed(&tl->mem->bufs[idx].seq, seq + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (nr_tasks > tl->mem->bufs[idx].capacity)
+		tasklist_grow(tl, idx, nr_tasks);
+
+	buf = &tl->mem->bufs[idx];
+	buf->nr_tasks = nr_tasks;
+	tasklist_get_cols(tl, buf->offset, buf->capacity, &c);
+	cols_store(&c, tasks, nr_tasks);
+	memcpy(c.changed, tl->changed,
+	       bitmap_longs(nr_tasks) * sizeof(unsigned long));
+
+	store_release(&buf->seq, seq + 2);
+	store_release(&tl->mem->gen, gen + 1);
+
+	/* there may be no reader listening (or its queue may be full) */
+	len = tasklist_notify_addr(&sa);
+	sendto(tl->notify_fd, NULL, 0, MSG_DONTWAIT, (struct sockaddr *)&sa,
+	       len);
+
+	return 1;
+}
+
+/**
+ *	tasklist_gen - get current task list generation
+ *	@tl: task list
+ *
+ *	Returns generation of the current snapshot (it changes every
+ *	time a new snapshot is published).
+ */
+unsigned int tasklist_gen(struct tasklist *tl)
+{
+	return load_acquire(&tl->mem->gen);
+}
+
+/**
+ *	tasklist_snapshot - get a consistent task list snapshot
+ *	@tl: task list
+ *	@snap: private snapshot (zeroed before the first call)
+ *
+ *	Updates @snap to the current buffer of @tl, retrying if the
+ *	writer reused the buffer in the meantime.  If the current
+ *	snapshot directly follows @snap only its changed rows are
+ *	copied (the other columns aren't read at all), otherwise all
+ *	rows are (@snap->full is set then).  Remaps @tl if the shared
+ *	memory object has grown.  Returns number of copied rows.
+ */
+int tasklist_snapshot(struct tasklist *tl, struct tasklist_snap *snap)
+{
+	while (1) {
+		unsigned int g = load_acquire(&tl->mem->gen);
+		struct tasklist_buf *buf = &tl->mem->bufs[g & 1];
+		unsigned int seq = load_acquire(&buf->seq);
+		struct tasklist_cols c;
+		unsigned long offset;
+		size_t size;
+		int nr_tasks, capacity, full, w, nr = 0;
+
+		if (seq & 1)
+			continue;
+
+		size = load_acquire(&tl->mem->size);
+		if (size > tl->size) {
+			tasklist_map(tl, size, PROT_READ);
+			continue;
+		}
+
+		nr_tasks = load_relaxed(&buf->nr_tasks);
+		capacity = load_relaxed(&buf->capacity);
+		offset = load_relaxed(&buf->offset);
+		if (nr_tasks < 0 || nr_tasks > capacity ||
+		    offset + tasklist_col_offset(TASKLIST_COLS, capacity) >
+		    tl->size)
+			continue;
+
+		if (nr_tasks > snap->size) {
+			snap->rows = realloc(snap->rows,
+					     nr_tasks * sizeof(*snap->rows));
+			snap->tasks = realloc(snap->tasks,
+					      nr_tasks * sizeof(*snap->tasks));
+			if (!snap->rows || !snap->tasks)
+				pabort("realloc tasks");
+			snap->size = nr_tasks;
+		}
+
+		full = !snap->valid || g != snap->gen + 1;
+		tasklist_get_cols(tl, offset, capacity, &c);
+
+		for (w = 0; w < bitmap_longs(nr_tasks); w++) {
+			unsigned long bits = full ? ~0UL : c.changed[w];
+
+			while (bits) {
+				int i = w * BITS_PER_LONG + __builtin_ctzl(bits);
+
+				if (i >= nr_tasks)
+					break;
+				bits &= bits - 1;
+
+				snap->rows[nr] = i;
+				cols_load_row(&c, i, &snap->tasks[nr++]);
+			}
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (load_relaxed(&buf->seq) != seq)
+			continue;
+
+		snap->gen = g;
+		snap->valid = 1;
+		snap->full = full;
+		snap->nr_tasks = nr_tasks;
+		snap->nr_changed = nr;
+
+		return nr;
+	}
+}
+
+/**
+ *	tasklist_notify_open - open task list notification socket
+ *
+ *	Binds the socket tasklist_publish() sends notifications about
+ *	new snapshots to (only one reader can do it).  Returns
+ *	non-blocking socket file descriptor.
+ */
+int tasklist_notify_open(void)
+{
+	struct sockaddr_un sa;
+	socklen_t len = tasklist_notify_addr(&sa);
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		pabort("socket tasklist notify");
+
+	if (bind(fd, (struct sockaddr *)&sa, len))
+		pabort("bind tasklist notify");
+
+	return fd;
+}
+
+/**
+ *	tasklist_notify_read - read task list notifications
+ *	@fd: socket opened by tasklist_notify_open()
+ *
+ *	Reads all pending notifications.  Returns their number.
+ */
+int tasklist_notify_read(int fd)
+{
+	char c;
+	int nr = 0;
+
+	while (recv(fd, &c, sizeof(c), MSG_DONTWAIT) >= 0)
+		nr++;
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		pabort("recv tasklist notify");
+
+	return nr;
+}
@@ -0,0 +1,652 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "common.h"
+#include "shm.h"
+#include "pidhash.h"
+#include "heap.h"
+#include "tbulmkd.h"
+
+/*
+ * tbulmkd keeps its own state for every task from the task list
+ * snapshot in task_table[] slots (indexed by PID with task_index).
+ * Slots are updated incrementally by update_task_table() so that
+ * indexes built on top of them (i.e. per-class RSS heaps) don't have
+ * to be rebuilt for every snapshot.
+ */
+struct task *task_table;
+static int task_table_size;
+static int free_slot = -1;
+static struct pidhash task_index;
+static unsigned int task_stamp;
+
+/* task_table[] slots of task list snapshot rows */
+static int *row_slots;
+static int row_slots_size;
+static int nr_rows;
+
+/* slots of tasks which may be gone (see update_task_table()) */
+static int *gone;
+static int nr_gone;
+static int gone_size;
+
+static int rss_before(int a, int b)
+{
+	return task_table[a].info.rss > task_table[b].info.rss;
+}
+
+static void rss_set_pos(int id, int pos)
+{
+	task_table[id].rss_pos = pos;
+}
+
+/* per-class max-heaps of task_table[] slots keyed by RSS */
+static struct heap *rss_heaps;
+
+static int deadline_before(int a, int b)
+{
+	return task_table[a].info.time < task_table[b].info.time;
+}
+
+static void deadline_set_pos(int id, int pos)
+{
+	task_table[id].deadline_pos = pos;
+}
+
+/*
+ * min-heap of background task_table[] slots keyed by activity time
+ * (timeout is the same for all tasks so it is also the expiry order)
+ */
+static struct heap deadline_heap = {
+	.before		= deadline_before,
+	.set_pos	= deadline_set_pos,
+};
+
+static int unkillable_before(int a, int b)
+{
+	return task_table[a].info.time > task_table[b].info.time;
+}
+
+/*
+ * max-heap of background task_table[] slots which can't be killed
+ * by the timeout (see task_killable()) keyed by activity time, they
+ * still count as background tasks for live_bg_task()
+ */
+static struct heap unkillable_heap = {
+	.before		= unkillable_before,
+	.set_pos	= deadline_set_pos,
+};
+
+/* victim memory accounting mode ("accounting" config line) */
+int mem_accounting = ACCOUNT_RSS;
+int accounting_budget = 20; /* ms per selection */
+
+/* smaps_rollup based task_mem() values are cached this long (ms) */
+#define MEM_CACHE_TIME 5000
+
+/* PIDs of tasks (re)classified since the last take_reclassified() */
+static pid_t *reclassified;
+static int nr_reclassified;
+static int reclassified_size;
+
+/**
+ *	task_class - get task type index
+ *	@tis: task entry
+ *
+ *	Returns classes[] index of the first class whose classification
+ *	rule matches the task or -1 if there is no such class.
+ */
+static int task_class(struct task_info_shm *tis)
+{
+	int i;
+
+	for (i = 0; i < nr_classes; i++) {
+		struct mem_class *c = &classes[i];
+
+		switch (c->rule) {
+		case CLASS_RULE_ANY:
+			return i;
+		case CLASS_RULE_TTY:
+			if (tis->tty_nr)
+				return i;
+			break;
+		case CLASS_RULE_NOTTY:
+			if (!tis->tty_nr)
+				return i;
+			break;
+		case CLASS_RULE_NAME:
+			if (!fnmatch(c->pattern, tis->name, 0))
+				return i;
+			break;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ *	update_rss_heap - update task position in RSS heaps
+ *	@id: task_table[] slot
+ *	@cls: task class
+ *
+ *	Puts task into the RSS heap of its class (or removes it from
+ *	RSS heaps if it was already killed, is a kernel thread or has
+ *	no class).
+ */
+static void update_rss_heap(int id, int cls)
+{
+	struct task *t = &task_table[id];
+
+	if (t->rss_pos >= 0 && (t->cls != cls || t->killed || !t->info.rss))
+		heap_del(&rss_heaps[t->cls], t->rss_pos);
+
+	t->cls = cls;
+
+	if (t->killed || !t->info.rss || cls < 0)
+		return;
+
+	if (t->rss_pos < 0)
+		heap_push(&rss_heaps[cls], id);
+	else
+		heap_fix(&rss_heaps[cls], t->rss_pos);
+}
+
+/* background task which is not killed, a kernel thread, exempted or stale */
+static inline int task_killable(struct task *t)
+{
+	return !t->killed && t->info.rss && !t->exempt && !t->stale;
+}
+
+static void drop_deadline_task(struct task *t)
+{
+	if (t->deadline_pos >= 0)
+		heap_del(t->unkillable ? &unkillable_heap : &deadline_heap,
+			 t->deadline_pos);
+}
+
+/**
+ *	update_deadline_heap - update task position in deadline heap
+ *	@id: task_table[] slot
+ *
+ *	Puts background task into the deadline heap or, if it can't be
+ *	killed, into the unkillable heap (or removes it from the heaps
+ *	if it is a foreground one).
+ */
+static void update_deadline_heap(int id)
+{
+	struct task *t = &task_table[id];
+	int unkillable = !task_killable(t);
+	struct heap *h = unkillable ? &unkillable_heap : &deadline_heap;
+
+	if (t->info.activity || (t->deadline_pos >= 0 &&
+				 t->unkillable != unkillable))
+		drop_deadline_task(t);
+
+	if (t->info.activity)
+		return;
+
+	t->unkillable = unkillable;
+	if (t->deadline_pos < 0)
+		heap_push(h, id);
+	else
+		heap_fix(h, t->deadline_pos);
+}
+
+/**
+ *	add_reclassified - remember task whose class changed
+ *	@pid: task PID number
+ */
+static void add_reclassified(pid_t pid)
+{
+	if (nr_reclassified == reclassified_size) {
+		reclassified_size = reclassified_size ?
+				    reclassified_size * 2 : 256;
+		reclassified = realloc(reclassified, reclassified_size *
+				       sizeof(*reclassified));
+		if (!reclassified)
+			pabort("realloc reclassified");
+	}
+
+	reclassified[nr_reclassified++] = pid;
+}
+
+static int alloc_task_slot(void)
+{
+	int id;
+
+	if (free_slot < 0) {
+		int i, size = task_table_size ? task_table_size * 2 : 256;
+
+		task_table = realloc(task_table, size * sizeof(*task_table));
+		if (!task_table)
+			pabort("realloc task_table");
+
+		for (i = size - 1; i >= task_table_size; i--) {
+			task_table[i].info.pid = 0;
+			task_table[i].next_free = free_slot;
+			free_slot = i;
+		}
+		task_table_size = size;
+	}
+
+	id = free_slot;
+	free_slot = task_table[id].next_free;
+
+	return id;
+}
+
+static void free_task_slot(int id)
+{
+	struct task *t = &task_table[id];
+
+	if (t->rss_pos >= 0)
+		heap_del(&rss_heaps[t->cls], t->rss_pos);
+	drop_deadline_task(t);
+
+	pidhash_remove(&task_index, t->info.pid);
+
+	t->info.pid = 0;
+	t->next_free = free_slot;
+	free_slot = id;
+}
+
+/**
+ *	update_task - update task_table[] entry from task list row
+ *	@tis: task list row
+ *
+ *	Adds a new task or updates the existing one (a task whose start
+ *	time changed is a new task reusing the PID).  Tasks are
+ *	(re)classified (and checked against the exemption list) only
+ *	when they are new or their name or TTY changes.  The deadline
+ *	heap is only touched for tasks whose activity (time) or RSS
+ *	changed.  Returns task_table[] slot of the task.
+ */
+static int update_task(struct task_info_shm *tis)
+{
+	struct task *t;
+	int id, cls, changed = 1;
+
+	id = pidhash_lookup(&task_index, tis->pid);
+	if (id >= 0 && task_table[id].info.start_time != tis->start_time) {
+		free_task_slot(id);
+		id = -1;
+	}
+
+	if (id < 0) {
+		id = alloc_task_slot();
+		t = &task_table[id];
+		memset(t, 0, sizeof(*t));
+		t->rss_pos = -1;
+		t->deadline_pos = -1;
+		t->cls = -1;
+		t->cg_idx = -1;
+		pidhash_insert(&task_index, tis->pid, id);
+		cls = task_class(tis);
+		t->exempt = task_exempted(tis->name);
+	} else {
+		t = &task_table[id];
+		cls = t->cls;
+		if (t->info.tty_nr != tis->tty_nr ||
+		    strcmp(t->info.name, tis->name)) {
+			cls = task_class(tis);
+			t->exempt = task_exempted(tis->name);
+			t->oom_adj_valid = 0;
+		} else if (t->info.activity == tis->activity &&
+			   t->info.time == tis->time &&
+			   !t->info.rss == !tis->rss) {
+			changed = 0;
+		}
+	}
+
+	if (cls != t->cls && cls >= 0)
+		add_reclassified(tis->pid);
+
+	t->info = *tis;
+	t->stamp = task_stamp;
+	update_rss_heap(id, cls);
+	if (changed) {
+		t->stale = 0;
+		update_deadline_heap(id);
+	}
+
+	return id;
+}
+
+static void add_gone(int id)
+{
+	if (nr_gone == gone_size) {
+		gone_size = gone_size ? gone_size * 2 : 256;
+		gone = realloc(gone, gone_size * sizeof(*gone));
+		if (!gone)
+			pabort("realloc gone");
+	}
+
+	gone[nr_gone++] = id;
+}
+
+/**
+ *	update_task_table - update task_table[] from task list snapshot
+ *	@snap: task list snapshot
+ *
+ *	Updates tasks of the changed @snap rows (see update_task()) and
+ *	frees slots of tasks which are no longer there.  Unchanged rows
+ *	hold the same tasks as before so they aren't looked at at all:
+ *	a task can only be gone if its row changed or was removed, so
+ *	only such tasks are checked (all slots are with a full
+ *	snapshot).
+ */
+void update_task_table(struct tasklist_snap *snap)
+{
+	int i, k;
+
+	if (!rss_heaps) {
+		rss_heaps = calloc(nr_classes, sizeof(*rss_heaps));
+		if (!rss_heaps)
+			pabort("calloc rss_heaps");
+
+		for (i = 0; i < nr_classes; i++) {
+			rss_heaps[i].before = rss_before;
+			rss_heaps[i].set_pos = rss_set_pos;
+		}
+	}
+
+	task_stamp++;
+	nr_gone = 0;
+
+	if (!snap->full) {
+		for (k = 0; k < snap->nr_changed; k++)
+			if (snap->rows[k] < nr_rows)
+				add_gone(row_slots[snap->rows[k]]);
+		for (i = snap->nr_tasks; i < nr_rows; i++)
+			add_gone(row_slots[i]);
+	}
+
+	if (snap->nr_tasks > row_slots_size) {
+		row_slots_size = snap->nr_tasks;
+		row_slots = realloc(row_slots,
+				    row_slots_size * sizeof(*row_slots));
+		if (!row_slots)
+			pabort("realloc row_slots");
+	}
+
+	for (k = 0; k < snap->nr_changed; k++)
+		row_slots[snap->rows[k]] = update_task(&snap->tasks[k]);
+	nr_rows = snap->nr_tasks;
+
+	if (snap->full) {
+		for (i = 0; i < task_table_size; i++)
+			if (task_table[i].info.pid &&
+			    task_table[i].stamp != task_stamp)
+				free_task_slot(i);
+		return;
+	}
+
+	for (k = 0; k < nr_gone; k++) {
+		struct task *t = &task_table[gone[k]];
+
+		if (t->info.pid && t->stamp != task_stamp)
+			free_task_slot(gone[k]);
+	}
+}
+
+/**
+ *	find_task - find task in task_table[]
+ *	@pid: task PID number
+ *
+ *	Returns task_table[] entry for @pid or NULL if not found.
+ */
+struct task *find_task(pid_t pid)
+{
+	int id = pidhash_lookup(&task_index, pid);
+
+	return id < 0 ? NULL : &task_table[id];
+}
+
+/**
+ *	mark_task_killed - mark task as killed
+ *	@t: task_table[] entry
+ *
+ *	Removes @t from RSS heaps so it won't be selected again while
+ *	it is still present in the task list snapshot.
+ */
+void mark_task_killed(struct task *t)
+{
+	t->killed = 1;
+	update_rss_heap(t - task_table, t->cls);
+	update_deadline_heap(t - task_table);
+}
+
+/**
+ *	mark_task_stale - mark task list entry of task as stale
+ *	@t: task_table[] entry
+ *
+ *	Moves @t to the unkillable heap until its task list entry
+ *	changes (the task list didn't catch up with the task yet).
+ */
+void mark_task_stale(struct task *t)
+{
+	t->stale = 1;
+	update_deadline_heap(t - task_table);
+}
+
+/**
+ *	first_deadline_task - get background task to exceed timeout first
+ *
+ *	Returns killable background task with the oldest activity time
+ *	or NULL if there is no such task.
+ */
+struct task *first_deadline_task(void)
+{
+	int id = heap_top(&deadline_heap);
+
+	return id < 0 ? NULL : &task_table[id];
+}
+
+/**
+ *	count_unkillable - count unkillable tasks more recent than given time
+ *	@pos: unkillable heap position to start at
+ *	@time: activity time
+ *	@max: maximum count
+ *
+ *	Only the heap nodes being counted are visited so it takes
+ *	O(@max) steps.
+ */
+static int count_unkillable(int pos, time_t time, int max)
+{
+	int nr;
+
+	if (max <= 0 || pos >= unkillable_heap.nr ||
+	    task_table[unkillable_heap.ids[pos]].info.time <= time)
+		return 0;
+
+	nr = 1;
+	nr += count_unkillable(2 * pos + 1, time, max - nr);
+	nr += count_unkillable(2 * pos + 2, time, max - nr);
+
+	return nr;
+}
+
+/**
+ *	live_bg_task - check whether task is a live background task
+ *	@t: task returned by first_deadline_task()
+ *
+ *	Returns non-zero if @t is one of the MAX_LIVE_BG_TASKS most
+ *	recent background tasks (killed tasks, kernel threads and
+ *	exempted tasks count too).  All killable tasks but @t are more
+ *	recent so only unkillable ones have to be counted.
+ */
+int live_bg_task(struct task *t)
+{
+	int nr = deadline_heap.nr - 1;
+
+	nr += count_unkillable(0, t->info.time, MAX_LIVE_BG_TASKS - nr);
+
+	return nr < MAX_LIVE_BG_TASKS;
+}
+
+/**
+ *	next_task - iterate over task_table[]
+ *	@t: current task_table[] entry (or NULL to start)
+ *
+ *	Returns the next used task_table[] entry or NULL at the end.
+ */
+struct task *next_task(struct task *t)
+{
+	int id = t ? t - task_table + 1 : 0;
+
+	for (; id < task_table_size; id++)
+		if (task_table[id].info.pid)
+			return &task_table[id];
+
+	return NULL;
+}
+
+/**
+ *	take_reclassified - take tasks (re)classified since the last call
+ *	@nr: returned number of tasks
+ *
+ *	Returns array of PIDs of tasks which got a (new) class since
+ *	the last call (valid until the next task_table[] update).
+ */
+pid_t *take_reclassified(int *nr)
+{
+	*nr = nr_reclassified;
+	nr_reclassified = 0;
+
+	return reclassified;
+}
+
+/**
+ *	task_mem - get memory expected to be freed by killing task
+ *	@t: task_table[] entry
+ *	@end: accounting budget end (now_ms() time)
+ *
+ *	Returns RSS with ACCOUNT_RSS accounting.  Otherwise returns PSS
+ *	(ACCOUNT_PSS) or USS (ACCOUNT_USS) read from smaps_rollup.  Swap
+ *	is not included as the memory levels don't account it (and RSS
+ *	has to stay an upper bound, see select_task_mem()).  The value
+ *	is cached for MEM_CACHE_TIME ms.  If there is no cached value
+ *	and the budget is already exhausted (or smaps_rollup can't be
+ *	read) the old value or RSS is used.
+ */
+ulong task_mem(struct task *t, long long end)
+{
+	struct task_smaps sm;
+	long long now;
+
+	if (mem_accounting == ACCOUNT_RSS)
+		return t->info.rss;
+
+	now = now_ms();
+	if (t->mem_time && now - t->mem_time < MEM_CACHE_TIME)
+		return t->mem;
+
+	if (now >= end || get_task_smaps(t->info.pid, &sm))
+		return t->mem_time ? t->mem : t->info.rss;
+
+	if (mem_accounting == ACCOUNT_PSS)
+		t->mem = sm.pss;
+	else
+		t->mem = sm.private;
+	t->mem_time = now;
+
+	return t->mem;
+}
+
+/**
+ *	select_task_mem - select task freeing the most memory
+ *	@idx: task type index
+ *	@in_cgroup: only select tasks belonging to a cgroup
+ *	@mem: returned memory expected to be freed (see task_mem())
+ *
+ *	Returns @idx class task (which belongs to a corresponding
+ *	cgroup if @in_cgroup is set) expected to free the most memory
+ *	when killed or NULL if there is no such task.  Tasks are looked
+ *	at in RSS order using the class RSS heap.  RSS is an upper
+ *	bound of PSS and USS so the walk stops at the first
+ *	task whose RSS is not bigger than the best value found so far
+ *	(with ACCOUNT_RSS accounting that is the first task) or when
+ *	accounting_budget ms are used up.  Tasks looked at are
+ *	temporarily taken off the heap and put back afterwards.
+ */
+struct task *select_task_mem(int idx, int in_cgroup, ulong *mem)
+{
+	static int *popped;
+	static int popped_size;
+	struct heap *h = &rss_heaps[idx];
+	struct task *victim = NULL;
+	long long end = now_ms() + accounting_budget;
+	int nr_popped = 0;
+	int id;
+
+	*mem = 0;
+
+	while ((id = heap_top(h)) >= 0) {
+		struct task *t = &task_table[id];
+
+		if (victim && (mem_accounting == ACCOUNT_RSS ||
+			       t->info.rss <= *mem || now_ms() >= end))
+			break;
+
+		if (!in_cgroup || check_pid_in_cgroup(t->info.pid, idx)) {
+			ulong m = task_mem(t, end);
+
+			if (!victim || m > *mem) {
+				victim = t;
+				*mem = m;
+			}
+		}
+
+		if (nr_popped == popped_size) {
+			popped_size = popped_size ? popped_size * 2 : 64;
+			popped = realloc(popped, popped_size * sizeof(*popped));
+			if (!popped)
+				pabort("realloc popped");
+		}
+
+		popped[nr_popped++] = heap_pop(h);
+	}
+
+	while (nr_popped)
+		heap_push(h, popped[--nr_popped]);
+
+	return victim;
+}
+
+/**
+ *	set_mem_accounting - set victim memory accounting mode
+ *	@name: accounting mode name ("rss", "pss" or "uss")
+ *	@budget: smaps_rollup reading time budget per selection (ms)
+ */
+void set_mem_accounting(const char *name, int budget)
+{
+	static const char *names[] = {
+		[ACCOUNT_RSS]	= "rss",
+		[ACCOUNT_PSS]	= "pss",
+		[ACCOUNT_USS]	= "uss",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		if (!strcmp(names[i], name))
+			break;
+
+	if (i == ARRAY_SIZE(names) || budget <= 0) {
+		printf("invalid accounting %s %d\n", name, budget);
+		return;
+	}
+
+	mem_accounting = i;
+	accounting_budget = budget;
+}
@@ -25,153 +25,334 @@
 #include <errno.h>
 #include <sys/mount.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <time.h>
 #include "common.h"
 #include "shm.h"
 #include "tbulmkd.h"
+#include "cgroups.h"
+#include "scanner.h"
 
 #define PFX "tbulkmd: "
 
-static struct tasklist_mem *tasklist_mem;
+static struct tasklist *tasklist;
 
-#define THRES_NR 2
-struct mem_threshold mem_thresholds[THRES_NR];
+/* private copy of tasklist task list */
+static struct tasklist_snap snap;
 
-enum {
-	THRES_DAEMONS_IDX	= 0,
-	THRES_APPS_IDX		= 1,
+struct mem_class *classes;
+int nr_classes;
+
+/* set once the config file defines its own classes */
+static int classes_configured;
+
+/* class rule names (config file) */
+static const char *class_rules[] = {
+	[CLASS_RULE_ANY]	= "any",
+	[CLASS_RULE_TTY]	= "tty",
+	[CLASS_RULE_NOTTY]	= "notty",
+	[CLASS_RULE_NAME]	= "name",
 };
 
-static char *exemption_list[MAX_NR_TASKS];
-static int exemption_list_len;
+/* memory threshold level action names (config file) */
+static const char *thres_actions[] = {
+	[THRES_NOTIFY]		= "notify",
+	[THRES_KILL_STALE]	= "kill-stale",
+	[THRES_KILL_RSS]	= "kill-rss",
+	[THRES_KILL_SCORE]	= "kill-score",
+};
+
+static int timeout = 60; /* timeout in seconds */
+static int use_cgroups = 0;
+static int cgroup_version = 0; /* 0 - detect */
+static int use_psi = 0;
+static int use_scanner = 0; /* scanner thread instead of proxy_shm */
+static int export_tasklist = 0; /* export scanner task list shm */
+
+/* PSI trigger parameters ("psi <some|full> <stall ms> <window ms>") */
+static char psi_type[8] = "some";
+static int psi_stall_ms = 150;
+static int psi_window_ms = 1000;
+static int psi_fd = -1;
+
+/* memory usage sampling interval for levels without events (secs) */
+#define SAMPLE_INTERVAL 1
+
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int signal_fd = -1;
+static int notify_fd = -1;
+
+/* maximum number of events returned by one epoll_wait() call */
+#define MAX_EPOLL_EVENTS 16
+
+/*
+ * epoll event data: memory threshold level events are identified by
+ * class index and level, other event sources have their own values.
+ */
+#define EV_LEVEL(idx, level)	((idx) * MAX_THRES_LEVELS + (level))
+#define EV_PSI			(~0U)
+#define EV_TIMER		(~1U)
+#define EV_SIGNAL		(~2U)
+#define EV_TASKLIST		(~3U)
+
+/* classes which got memory threshold level events (see event_loop()) */
+static char *fired_classes;
+
+/* set if some class has memory threshold levels without events */
+static int sample_lowmem;
+
+/* maximum time to wait for a killed task to free its memory (ms) */
+#define KILL_WAIT_TIMEOUT 1000
+
+/* usage has to drop this much below the threshold to end the wait */
+#define LOWMEM_HYSTERESIS (2 << 20)
+
+/**
+ *	refresh_tasks - refresh private copy of tasklist task list
+ *
+ *	Takes a new tasklist snapshot (unless the published one didn't
+ *	change since the last call) and updates task_table[] from it.
+ */
+static void refresh_tasks(void)
+{
+	if (snap.valid && tasklist_gen(tasklist) == snap.gen)
+		return;
 
-#define POLL_TIMEOUT 1000
+	tasklist_snapshot(tasklist, &snap);
+	update_task_table(&snap);
+}
 
 /**
- *	select_pid_rss - select PID with the biggest RSS
+ *	select_pid_mem - select PID freeing the most memory
  *	@idx: task type index
- *	@max_rss: maximum RSS value
+ *	@in_cgroup: only select tasks belonging to a cgroup
+ *	@mem: returned memory expected to be freed
  *
- *	Scans tasklist_mem list of tasks and selects the one with
- *	the biggest RSS.  Skips tasks of THRES_DEAMONS_IDX type
- *	without TTY and of THRES_APPS_IDX type with TTY.  It also
- *	verifies whether given task belongs to a corresponding
- *	cgroup (identified by @idx).  Returns PID of the task with
- *	biggest RSS value and sets @max_rss to the biggest RSS value.
+ *	Selects the task of class @idx expected to free the most
+ *	memory (RSS, PSS or USS depending on mem_accounting, see
+ *	select_task_mem()).  It also verifies whether given task
+ *	belongs to a corresponding cgroup (identified by @idx) if
+ *	@in_cgroup is set.  Returns task_table[] entry of the task.
  *
- *	This function needs to take tasklist_sem->sem semaphore to
- *	protect access to tasklist_mem task list.
+ *	The private copy of tasklist task list is refreshed first
+ *	so the selection sees the latest snapshot.  RSS values come
+ *	from the snapshot so the caller should re-validate the
+ *	selected task.
  */
-static pid_t select_pid_rss(int idx, ulong *max_rss)
+static struct task *select_pid_mem(int idx, int in_cgroup, ulong *mem)
 {
-	pid_t last_pid = 0;
-	int i;
+	refresh_tasks();
 
-	sem_wait(&tasklist_mem->sem);
-
-	for (i = 0; i < MAX_NR_TASKS; i++) {
-		struct task_info_shm *tis;
-		struct task_info ti;
-		pid_t pid;
-		int j;
+	return select_task_mem(idx, in_cgroup, mem);
+}
 
-		tis = &tasklist_mem->tasks[i];
-		pid = tis->pid;
-		if (!pid)
+/**
+ *	wait_for_kill - wait for a killed task to free its memory
+ *	@idx: task type index (or -1 if not killed for a cgroup)
+ *	@level: memory threshold level
+ *	@pidfd: pidfd of the killed task (or -1)
+ *
+ *	Waits until the killed task has exited (its @pidfd becomes
+ *	readable) or the memory usage of the cgroup (identified by @idx)
+ *	has dropped LOWMEM_HYSTERESIS below the memory threshold @level
+ *	(the threshold eventfd also fires on crossing it downwards), but
+ *	no longer than KILL_WAIT_TIMEOUT ms.  Without @pidfd only the
+ *	threshold eventfd and the timeout end the wait.
+ */
+static void wait_for_kill(int idx, int level, int pidfd)
+{
+	struct mem_threshold *thres =
+		idx < 0 ? NULL : &classes[idx].levels[level];
+	long long deadline = now_ms() + KILL_WAIT_TIMEOUT;
+	struct pollfd pfds[2];
+	int left;
+
+	pfds[0].fd = thres ? thres->efd : -1;
+	pfds[0].events = thres ? thres->events : 0;
+	pfds[0].revents = 0;
+	pfds[1].fd = pidfd;
+	pfds[1].events = POLLIN;
+	pfds[1].revents = 0;
+
+	while ((left = deadline - now_ms()) > 0) {
+		if (poll(pfds, 2, left) <= 0)
 			break;
 
-		if ((idx == THRES_DAEMONS_IDX && tis->tty_nr) ||
-		    (idx == THRES_APPS_IDX && !tis->tty_nr))
-			continue;
-
-		if (!check_pid_in_cgroup(pid, idx))
-			continue;
+		/* the victim has exited */
+		if (pfds[1].revents)
+			break;
 
-		if (get_task_info_stat(pid, NULL, &ti))
-			continue;
+		if (pfds[0].revents & pfds[0].events) {
+			process_event(idx, level);
+			if (get_mem_usage(idx) <
+			    thres->mem_limit - LOWMEM_HYSTERESIS)
+				break;
+		}
+	}
+}
 
-		// debug
-//		if (strcmp("m", ti.name)) {
-//			put_task_info(&ti);
-//			continue;
-//		}
+/**
+ *	kill_lowmem_task - kill task selected because of low memory
+ *	@t: selected task
+ *	@pfx: log message prefix
+ *	@pidfdp: returned pidfd of the killed task
+ *
+ *	Marks @t as killed (so it is not selected again while it is
+ *	still in the task list snapshot) and kills it.  The pidfd
+ *	returned in @pidfdp (or -1) has to be closed by the caller.
+ *	Returns 0 on success, ESRCH if the task is gone.
+ */
+static int kill_lowmem_task(struct task *t, const char *pfx, int *pidfdp)
+{
+	struct task_info ti;
+	pid_t pid = t->info.pid;
 
-		if (ti.rss > *max_rss) {
-			*max_rss = ti.rss;
-			last_pid = pid;
-		}
+	mark_task_killed(t);
 
-		put_task_info(&ti);
-	}
+	/*
+	 * kill_task() re-validates the selected task (it may have
+	 * exited already).
+	 */
+	if (kill_task(pid, t->info.start_time, &ti, pidfdp))
+		return ESRCH;
 
-	sem_post(&tasklist_mem->sem);
+	print_timestamp();
+	printf("[%s] killed %d rss %luMiB (%s)\n", pfx, pid,
+	       ti.rss / 1024 / 1024, ti.name);
 
-	return last_pid;
+	return 0;
 }
 
 /**
- *	poll_lowmem - poll for tasks exceeding memory limits
+ *	handle_psi_event - handle memory pressure event
  *
- *	Polls for tasks of THRES_DAEMONS_IDX and THRES_APPS_IDX types
- *	that exceed memory limit.  Kills tasks with the biggest RSS
- *	value while memory limit is exceeded.  Sleeps for 1 second
- *	before selecting the next task to kill while memory limit is
- *	exceeded.  This function is only used when cgroups suppport
- *	is enabled.
+ *	Kills the task with the biggest RSS (preferring tasks of
+ *	classes defined later in the config file, i.e. apps over
+ *	daemons for the default classes) and waits for it to exit.
+ *	Only one task is killed per event, the trigger fires again if
+ *	the memory pressure persists.
  */
-static void poll_lowmem(void)
+static void handle_psi_event(void)
 {
-	struct pollfd pollfds[THRES_NR];
+	int i;
 
-	setup_events(pollfds, THRES_DAEMONS_IDX);
-	setup_events(pollfds, THRES_APPS_IDX);
+	for (i = nr_classes - 1; i >= 0; i--) {
+		struct task *t;
+		ulong mem;
+		int pidfd;
 
-	while (poll(pollfds, THRES_NR, POLL_TIMEOUT) > 0) {
-		int i;
+		while ((t = select_pid_mem(i, 0, &mem))) {
+			if (kill_lowmem_task(t, "psi", &pidfd))
+				continue;
 
-		if (DEBUG) {
-			print_timestamp();
-			puts("got lowmem event");
+			wait_for_kill(-1, 0, pidfd);
+			if (pidfd >= 0)
+				close(pidfd);
+			return;
 		}
+	}
+}
 
-		for (i = 0; i < THRES_NR; i++) {
-			struct mem_threshold *thres = &mem_thresholds[i];
+/**
+ *	handle_lowmem - handle memory threshold levels of a cgroup
+ *	@idx: task type index
+ *
+ *	Finds the highest memory threshold level exceeded by the memory
+ *	usage of cgroup (identified by @idx) and takes its action:
+ *	THRES_NOTIFY reports reaching the level, THRES_KILL_STALE kills
+ *	least recently active background tasks, THRES_KILL_RSS kills
+ *	tasks with the biggest RSS value and THRES_KILL_SCORE kills
+ *	tasks chosen by victim_policy while the level is exceeded.
+ *	Memory expected to be freed by a kill (see task_mem()) is
+ *	subtracted from the usage.  Only if that isn't enough to get
+ *	below the level it waits (see wait_for_kill()) for the memory
+ *	to be freed and re-reads the usage before selecting the next
+ *	task to kill, otherwise the next task is killed right away.
+ */
+static void handle_lowmem(int idx)
+{
+	struct mem_class *class = &classes[idx];
+	long long usage = get_mem_usage(idx);
+	struct mem_threshold *thres;
+	int level;
 
-			if (pollfds[i].revents & POLLIN) {
-				process_event(i);
+	for (level = class->nr_levels - 1; level >= 0; level--)
+		if (usage >= class->levels[level].mem_limit)
+			break;
 
-				while (get_mem_usage(i) >= thres->mem_limit) {
-					struct task_info ti;
-					ulong rss = 0;
-					pid_t pid = select_pid_rss(i, &rss);
+	/* report reaching a level only once */
+	if (level == class->cur_level && level >= 0 &&
+	    class->levels[level].action == THRES_NOTIFY)
+		return;
 
-					if (!pid)
-						continue;
+	class->cur_level = level;
+	if (level < 0)
+		return;
 
-					if (get_task_info_stat(pid, NULL, &ti))
-						continue;
+	thres = &class->levels[level];
 
-					print_timestamp();
-					printf("[cgroups] killing %d rss %luMiB"
-					       " (%s)\n", pid, rss / 1024 / 1024,
-					       ti.name);
-					put_task_info(&ti);
-					kill(pid, SIGKILL);
+	if (thres->action == THRES_NOTIFY) {
+		print_timestamp();
+		printf("[lowmem] %s usage %lldMiB above %d%% threshold\n",
+		       class->name, usage >> 20, thres->percent);
+		return;
+	}
 
-					sleep(1);
-				}
-			}
+	while (usage >= thres->mem_limit) {
+		const char *pfx;
+		struct task *t;
+		ulong mem = 0;
+		int pidfd;
+
+		switch (thres->action) {
+		case THRES_KILL_STALE:
+			refresh_tasks();
+			t = select_victim(idx, POLICY_STALE, &mem);
+			pfx = "stale";
+			break;
+		case THRES_KILL_SCORE:
+			refresh_tasks();
+			t = select_victim(idx, victim_policy, &mem);
+			pfx = "score";
+			break;
+		default:
+			t = select_pid_mem(idx, 1, &mem);
+			pfx = "cgroups";
+			break;
 		}
-	}
 
-	cleanup_events(THRES_APPS_IDX);
-	cleanup_events(THRES_DAEMONS_IDX);
-}
+		/* Nothing left to kill, wait for the next event. */
+		if (!t)
+			break;
 
+		if (kill_lowmem_task(t, pfx, &pidfd))
+			continue;
 
-static int timeout = 60; /* timeout in seconds */
-static int use_cgroups = 0;
-int apps_mem_percent = 90;
-int daemons_mem_percent = 10;
+		/*
+		 * The victim is not expected to free enough memory, kill
+		 * the next task without waiting for this one to exit.
+		 */
+		if (usage - (long long)mem >= thres->mem_limit) {
+			if (pidfd >= 0)
+				close(pidfd);
+			usage -= mem;
+			continue;
+		}
+
+		wait_for_kill(idx, level, pidfd);
+		if (pidfd >= 0)
+			close(pidfd);
+
+		usage = get_mem_usage(idx);
+	}
+}
+
+/* memory percent of the default classes (no classes in config file) */
+static int apps_mem_percent = 90;
+static int daemons_mem_percent = 10;
 
 static void print_usage(char *argv0)
 {
@@ -180,7 +361,14 @@ static void print_usage(char *argv0)
 	       "-a, --apps	set memory percent for apps cgmem\n"
 	       "-d, --daemons	set memory percent for daemons cgmem\n"
 	       "-c, --cgroups	use control groups memory controller\n"
+	       "-g, --cgroup-version	use control groups version (1 or 2)\n"
+	       "-p, --psi	use memory pressure stall information\n"
 	       "-t, --timeout	set timeout (in seconds)\n"
+	       "-s, --scanner	scan tasks in a thread (no proxy_shm)\n"
+	       "-n, --netlink	use proc connector events in the scanner\n"
+	       "-x, --export	export scanner task list for other readers\n"
+	       "-j, --jobs	set number of scanner /proc scanning threads\n"
+	       "-u, --uring	read /proc files using io_uring in the scanner\n"
 	       "-h, --help	display this help message\n"
 	       "\n",
 	       argv0);
@@ -192,13 +380,20 @@ static void parse_args(int argc, char *argv[])
 		{ "apps",	1, NULL, 'a' },
 		{ "daemons",	1, NULL, 'd' },
 		{ "cgroups",	0, NULL, 'c' },
+		{ "cgroup-version", 1, NULL, 'g' },
+		{ "psi",	0, NULL, 'p' },
 		{ "timeout",	1, NULL, 't' },
+		{ "scanner",	0, NULL, 's' },
+		{ "netlink",	0, NULL, 'n' },
+		{ "export",	0, NULL, 'x' },
+		{ "jobs",	1, NULL, 'j' },
+		{ "uring",	0, NULL, 'u' },
 		{ "help",	0, NULL, 'h' },
 	};
 	int c;
 
 	while (1) {
-		c = getopt_long(argc, argv, "a:d:t:hc", opts, NULL);
+		c = getopt_long(argc, argv, "a:d:g:t:j:hcpsnxu", opts, NULL);
 		if (c < 0)
 			break;
 
@@ -220,11 +415,42 @@ static void parse_args(int argc, char *argv[])
 			print_timestamp();
 			printf("using control groups memory controller\n");
 			break;
+		case 'g':
+			cgroup_version = atoi(optarg);
+			if (cgroup_version != 1 && cgroup_version != 2) {
+				print_usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'p':
+			use_psi = 1;
+			print_timestamp();
+			printf("using memory pressure stall information\n");
+			break;
 		case 't':
 			timeout = atoi(optarg);
 			print_timestamp();
 			printf("using %d seconds timeout\n", timeout);
 			break;
+		case 's':
+			use_scanner = 1;
+			print_timestamp();
+			printf("using scanner thread\n");
+			break;
+		case 'n':
+			scan_netlink = 1;
+			break;
+		case 'x':
+			export_tasklist = 1;
+			break;
+		case 'j':
+			scan_workers = atoi(optarg);
+			if (scan_workers < 1)
+				scan_workers = 1;
+			break;
+		case 'u':
+			scan_uring = 1;
+			break;
 		case 'h':
 			print_usage(argv[0]);
 			exit(1);
@@ -233,62 +459,201 @@ static void parse_args(int argc, char *argv[])
 	}
 }
 
-static int tasklist_fd;
-
 /**
- *	init_tasklist - init tasklist_mem list of tasks
+ *	init_tasklist - init tasklist list of tasks
  *
- *	Opens and mmap()s shared memory area containing list of tasks.
+ *	Opens and mmap()s shared memory area containing list of tasks
+ *	published by proxy_shm.  With the scanner thread the task list
+ *	lives in process memory instead (or in the shared memory area
+ *	if it is exported) and holds the first scan once this returns.
  */
 void init_tasklist(void)
 {
-	int ret;
+	struct tasklist *tl;
 
-	tasklist_fd = shm_open("/tbulmkd_tasklist", O_RDWR, 0600);
-	if (tasklist_fd < 0)
-		pabort("shm_open tasklist");
-
-	ret = ftruncate(tasklist_fd, sizeof(*tasklist_mem));
-	if (ret)
-		pabort("ftruncate");
+	if (!use_scanner) {
+		tasklist = tasklist_open(TASKLIST_SHM_NAME);
+		return;
+	}
 
-	tasklist_mem = mmap(NULL, sizeof(*tasklist_mem),
-			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED,
-			tasklist_fd, 0);
-	if (tasklist_mem == MAP_FAILED)
-		pabort("mmap tasklist");
+	tl = tasklist_create(export_tasklist ? TASKLIST_SHM_NAME : NULL);
+	scanner_start(tl);
+	tasklist = tasklist_reader(tl);
 }
 
 /**
- *	free_tasklist - free tasklist_mem list of tasks
+ *	free_tasklist - free tasklist list of tasks
  *
  *	munmap()s and closes shared memory area containing list of tasks.
  */
 void free_tasklist(void)
 {
-	munmap(tasklist_mem, sizeof(*tasklist_mem));
-	close(tasklist_fd);
+	tasklist_close(tasklist);
+	free(snap.rows);
+	free(snap.tasks);
 }
 
 static char *config_file = "tbulmkd.cfg";
 
 #define MAX_TASK_NAME 100
 
+/**
+ *	free_classes - free task classes
+ */
+static void free_classes(void)
+{
+	int i;
+
+	for (i = 0; i < nr_classes; i++) {
+		free(classes[i].name);
+		free(classes[i].pattern);
+	}
+
+	free(classes);
+	classes = NULL;
+	nr_classes = 0;
+}
+
+/**
+ *	add_class - add task class
+ *	@name: class (and its cgroup) name
+ *	@percent: class memory limit (percent of total memory)
+ *	@rule: classification rule name
+ *	@pattern: task name pattern (fnmatch(3)) for "name" rule
+ *
+ *	Appends task class to classes[].  The first class added from
+ *	the config file replaces the default ones.
+ */
+static void add_class(const char *name, int percent, const char *rule,
+		      const char *pattern)
+{
+	struct mem_class *class;
+	int r;
+
+	for (r = 0; r < ARRAY_SIZE(class_rules); r++)
+		if (!strcmp(class_rules[r], rule))
+			break;
+
+	if (r == ARRAY_SIZE(class_rules) || percent <= 0 || percent > 100 ||
+	    strchr(name, '/') || (r == CLASS_RULE_NAME && !pattern)) {
+		printf("invalid class %s %d %s\n", name, percent, rule);
+		return;
+	}
+
+	if (!classes_configured) {
+		free_classes();
+		classes_configured = 1;
+	}
+
+	class = realloc(classes, (nr_classes + 1) * sizeof(*classes));
+	if (!class)
+		pabort("realloc classes");
+	classes = class;
+
+	class = &classes[nr_classes++];
+	memset(class, 0, sizeof(*class));
+	class->name = strdup(name);
+	class->percent = percent;
+	class->rule = r;
+	class->pattern = pattern ? strdup(pattern) : NULL;
+	class->cur_level = -1;
+}
+
+/**
+ *	init_classes - initialize default task classes
+ *
+ *	Adds "daemons" (tasks without TTY) and "apps" (tasks with TTY)
+ *	classes, used unless the config file defines its own classes.
+ */
+static void init_classes(void)
+{
+	add_class("daemons", daemons_mem_percent, "notty", NULL);
+	add_class("apps", apps_mem_percent, "tty", NULL);
+	classes_configured = 0;
+}
+
+/**
+ *	add_thres_level - add memory threshold level
+ *	@class: cgroup name
+ *	@percent: threshold level (percent of cgroup memory limit)
+ *	@action: threshold level action name
+ *
+ *	Adds memory threshold level to the class named @class keeping
+ *	its levels sorted by @percent.
+ */
+static void add_thres_level(const char *class, int percent,
+			    const char *action)
+{
+	struct mem_threshold *levels;
+	int idx, act, i;
+
+	for (idx = 0; idx < nr_classes; idx++)
+		if (!strcmp(classes[idx].name, class))
+			break;
+
+	for (act = 0; act < ARRAY_SIZE(thres_actions); act++)
+		if (!strcmp(thres_actions[act], action))
+			break;
+
+	if (idx == nr_classes || act == ARRAY_SIZE(thres_actions) ||
+	    percent <= 0 || percent > 100 ||
+	    classes[idx].nr_levels == MAX_THRES_LEVELS) {
+		printf("invalid threshold %s %d %s\n", class, percent, action);
+		return;
+	}
+
+	levels = classes[idx].levels;
+	for (i = classes[idx].nr_levels; i > 0; i--) {
+		if (levels[i - 1].percent <= percent)
+			break;
+		levels[i] = levels[i - 1];
+	}
+
+	levels[i].percent = percent;
+	levels[i].action = act;
+	classes[idx].nr_levels++;
+}
+
+/**
+ *	init_thres_levels - initialize default memory threshold levels
+ *
+ *	Cgroups without memory threshold levels in the config file get
+ *	a single THRES_KILL_RSS level just below their memory limit.
+ */
+static void init_thres_levels(void)
+{
+	int i;
+
+	for (i = 0; i < nr_classes; i++)
+		if (!classes[i].nr_levels)
+			add_thres_level(classes[i].name, 100,
+					thres_actions[THRES_KILL_RSS]);
+}
+
 /**
  *	init_config_file - initialize configuration
  *
  *	Parses config file (tbulmkd.cfg by default) and does
- *	configuration initialization.  For now it just builds
- *	the list of exempted tasks.
+ *	configuration initialization.  It builds the list of
+ *	exempted tasks ("exemption <name or glob pattern>" lines,
+ *	see exempt.c), sets PSI trigger parameters ("psi <some|full>
+ *	<stall ms> <window ms>" line), task classes ("class <name> <percent>
+ *	<any|tty|notty|name> [pattern]" lines) and memory threshold
+ *	levels ("threshold <class> <percent>
+ *	<notify|kill-stale|kill-rss|kill-score>" lines).  Classes have
+ *	to be defined before their threshold levels.  "policy
+ *	<rss|stale|weighted>" and "weight <rss|age|oom|recent|fg>
+ *	<value>" lines configure victim scoring (see policy.c) and
+ *	"accounting <rss|pss|uss> [budget ms]" line sets how memory
+ *	freed by killing a task is estimated (see task_mem()).
  *
- *	Please note that maximum task name is limited to 100
- *	bytes currently.
+ *	Please note that maximum class pattern length is limited to
+ *	100 bytes currently.
  */
 static void init_config_file(void)
 {
 	FILE *f;
 	char buf[4096];
-	int i = 0;
 
 	f = fopen(config_file, "r");
 	if (!f) {
@@ -299,32 +664,62 @@ static void init_config_file(void)
 
 	while (fgets(buf, sizeof(buf), f)) {
 		char *s = buf, es[MAX_TASK_NAME];
-		int j;
+		char class[32], action[32];
+		int j, n;
 
 		if (*s == '#')
 			continue;
 
-		j = sscanf(s, "exemption %s", es);
-		if (j != 1)
+		if (sscanf(s, "psi %7s %d %d", psi_type, &psi_stall_ms,
+			   &psi_window_ms) == 3)
 			continue;
 
-		exemption_list[i++] = strdup(es);
-	}
+		n = sscanf(s, "class %31s %d %31s %99s", class, &j, action,
+			   es);
+		if (n >= 3) {
+			add_class(class, j, action, n == 4 ? es : NULL);
+			continue;
+		}
 
-	exemption_list_len = i;
+		if (sscanf(s, "policy %31s", action) == 1) {
+			set_victim_policy(action);
+			continue;
+		}
 
-	fclose(f);
-}
+		if (sscanf(s, "weight %31s %d", action, &j) == 2) {
+			set_policy_weight(action, j);
+			continue;
+		}
 
-static void print_exemption_list(void)
-{
-	int i;
+		n = sscanf(s, "accounting %31s %d", action, &j);
+		if (n >= 1) {
+			set_mem_accounting(action,
+					   n == 2 ? j : accounting_budget);
+			continue;
+		}
 
-	printf("Exemption list:\n");
+		if (sscanf(s, "threshold %31s %d %31s", class, &j,
+			   action) == 3) {
+			add_thres_level(class, j, action);
+			continue;
+		}
 
-	for (i = 0; i < exemption_list_len; i++) {
-		printf("\t%s\n", exemption_list[i]);
+		/* the rest of the line, task names may contain spaces */
+		n = 0;
+		sscanf(s, "exemption %n", &n);
+		if (n > strlen("exemption")) {
+			char *end = s + strcspn(s, "\r\n");
+
+			while (end > s + n && (end[-1] == ' ' ||
+					       end[-1] == '\t'))
+				end--;
+			*end = '\0';
+			if (s[n])
+				add_exemption(s + n);
+		}
 	}
+
+	fclose(f);
 }
 
 /**
@@ -335,223 +730,375 @@ static void print_exemption_list(void)
  */
 static void free_config_file(void)
 {
-	int i;
-
-	for (i = 0; i < exemption_list_len; i++)
-		free(exemption_list[i]);
-
-	exemption_list_len = 0;
+	free_exemptions();
 }
 
-#define MAX_LIVE_BG_TASKS 6
-
-struct bg_task {
-	pid_t pid;
-	time_t time;
-};
+/**
+ *	move_tasks - move (re)classified tasks to their class cgroups
+ *
+ *	Only tasks whose class changed since the last call are moved
+ *	(see take_reclassified()).
+ */
+static void move_tasks(void)
+{
+	pid_t *pids;
+	int nr, i;
 
-static struct bg_task live_bg_tasks[MAX_LIVE_BG_TASKS];
+	pids = take_reclassified(&nr);
+	if (!use_cgroups || !nr)
+		return;
 
-static void print_bg_tasks(void)
-{
-	int i;
+	invalidate_cgroup_members();
 
-	printf("Live background tasks:\n");
+	for (i = 0; i < nr; i++) {
+		struct task *t = find_task(pids[i]);
 
-	for (i = 0; i < MAX_LIVE_BG_TASKS; i++) {
-		struct bg_task *bt = &live_bg_tasks[i];
+		/*
+		 * TODO: classification (task_class()) is just
+		 *       an approximation and should be
+		 *       accompanied by a list of exemptions..
+		 */
+		if (!t || t->cls < 0 || t->cg_idx == t->cls)
+			continue;
 
-		printf("\t%d pid %d time %u\n", i, bt->pid, (unsigned)bt->time);
+		add_pid_to_cgroup(t->info.pid, t->cls);
+		t->cg_idx = t->cls;
 	}
 }
 
-int main(int argc, char *argv[])
+/**
+ *	scan_tasks - handle tasklist task list changes
+ *
+ *	Takes a new tasklist task list snapshot, moves new tasks to
+ *	their class cgroups (if cgroups support is enabled) and kills
+ *	background tasks which exceeded timeout value.  Only the
+ *	tasks at the top of the deadline heap (oldest activity time
+ *	first) are looked at.  The MAX_LIVE_BG_TASKS most recent
+ *	background tasks (counting killed ones, kernel threads and
+ *	exempted tasks too) are never killed.  Returns the earliest
+ *	time the next background task will exceed timeout value (or 0
+ *	if there is no such task).
+ */
+static time_t scan_tasks(void)
 {
-	int ret;
+	struct task *t;
+	time_t now;
 
-	init_config_file();
-	if (DEBUG)
-		print_exemption_list();
+	/*
+	 * Work on a private snapshot of tasklist task list so
+	 * proxy_shm is never blocked by the scan below.
+	 */
+	refresh_tasks();
+	move_tasks();
 
-	ret = mlockall(MCL_FUTURE);
-	if (ret)
-		pabort("mlockall");
+	now = time(NULL);
+	if (now == -1)
+		pabort("time");
 
-	parse_args(argc, argv);
-
-	if (use_cgroups)
-		init_cgroups();
+	while ((t = first_deadline_task())) {
+		struct task_info ti;
+		pid_t pid = t->info.pid;
 
-	init_tasklist();
+		if (now - t->info.time <= timeout)
+			return t->info.time + timeout + 1;
 
-	while (1) {
-		int i, j;
+		/* all remaining ones are live background tasks */
+		if (live_bg_task(t))
+			break;
 
 		/*
-		 * Take tasklist_sem->sem semaphore to protect access to tasklist_mem
-		 * task list.
+		 * tasklist may be stale (i.e. proxy_shm tracking
+		 * tasks with proc connector events) so re-validate
+		 * the task identity and activity before killing it.
+		 * Tasks failing that are not looked at again until
+		 * their task list entry changes.
 		 */
-		sem_wait(&tasklist_mem->sem);
+		if (get_task_info(pid, NULL, &ti)) {
+			mark_task_stale(t);
+			continue;
+		}
 
-		memset(live_bg_tasks, 0, sizeof(struct bg_task) * MAX_LIVE_BG_TASKS);
+		/* activity is only reported to proxy_shm (see activity.h) */
+		if (ti.activity == ACTIVITY_UNKNOWN) {
+			ti.activity = t->info.activity;
+			ti.time = t->info.time;
+		}
 
-		for (i = 0; i < MAX_NR_TASKS; i++) {
-			struct task_info_shm *tis = &tasklist_mem->tasks[i];
-			pid_t pid;
+		if (ti.start_time != t->info.start_time || ti.activity ||
+		    now - ti.time <= timeout) {
+			mark_task_stale(t);
+			continue;
+		}
 
-			pid = tis->pid;
-			if (!pid)
-				break;
+		print_timestamp();
+		printf("[timeout] killing %d timeout %d secs rss %luMiB"
+		       " (%s)\n", pid, (unsigned)(now - t->info.time),
+		       ti.rss / 1024 / 1024, ti.name);
+		mark_task_killed(t);
+		kill_task(pid, t->info.start_time, NULL, NULL);
+	}
 
-			/*
-			 * Find MAX_LIVE_BG_TASKS tasks with the biggest
-			 * time values (== most recent tasks) and keep them
-			 * in live_bg_tasks[].
-			 */
-			for (j = 0; j < MAX_LIVE_BG_TASKS; j++) {
-				struct bg_task *bt = &live_bg_tasks[j];
-				int k;
+	return 0;
+}
 
-				if (tis->activity)
-					continue;
+/**
+ *	epoll_add - add file descriptor to the event loop
+ *	@fd: file descriptor
+ *	@events: epoll events
+ *	@data: event data (see EV_LEVEL() and EV_PSI)
+ */
+static void epoll_add(int fd, unsigned int events, uint32_t data)
+{
+	struct epoll_event ev = { .events = events, .data.u32 = data };
 
-				if (tis->time <= bt->time)
-					continue;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		pabort("epoll_ctl");
+}
+
+/**
+ *	init_events - init event sources
+ *
+ *	Creates the epoll instance and adds memory threshold level
+ *	events of all classes (if cgroups support is enabled), the
+ *	memory pressure trigger (if PSI support is enabled), timer
+ *	(see arm_timer()), termination signals and tasklist task list
+ *	notifications to it.  The events stay registered for the whole
+ *	daemon lifetime.
+ */
+static void init_events(void)
+{
+	sigset_t mask;
+	int i, j;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		pabort("epoll_create1");
+
+	/* task activity times are wall clock ones */
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0)
+		pabort("timerfd_create");
+	epoll_add(timer_fd, EPOLLIN, EV_TIMER);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL))
+		pabort("sigprocmask");
+
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0)
+		pabort("signalfd");
+	epoll_add(signal_fd, EPOLLIN, EV_SIGNAL);
+
+	notify_fd = tasklist_notify_open();
+	epoll_add(notify_fd, EPOLLIN, EV_TASKLIST);
+
+	fired_classes = calloc(nr_classes, sizeof(*fired_classes));
+	if (!fired_classes)
+		pabort("calloc fired_classes");
+
+	for (i = 0; use_cgroups && i < nr_classes; i++) {
+		setup_events(i);
+
+		for (j = 0; j < classes[i].nr_levels; j++) {
+			struct mem_threshold *thres = &classes[i].levels[j];
+
+			if (thres->efd >= 0)
+				epoll_add(thres->efd, thres->events,
+					  EV_LEVEL(i, j));
+		}
 
-				for (k = MAX_LIVE_BG_TASKS - 1; k > j; k--) {
-					live_bg_tasks[k].time =
-						live_bg_tasks[k - 1].time;
-					live_bg_tasks[k].pid =
-						live_bg_tasks[k - 1].pid;
-				}
+		if (classes[i].levels[0].efd < 0)
+			sample_lowmem = 1;
+	}
 
-				bt->time = tis->time;
-				bt->pid = tis->pid;
-				break;
-			}
+	if (psi_fd >= 0)
+		epoll_add(psi_fd, EPOLLPRI, EV_PSI);
+}
+
+/**
+ *	free_events - free event sources
+ *
+ *	Cleanups event sources setup by init_events().
+ */
+static void free_events(void)
+{
+	int i;
+
+	for (i = 0; use_cgroups && i < nr_classes; i++)
+		cleanup_events(i);
+
+	close(notify_fd);
+	close(signal_fd);
+	close(timer_fd);
+	free(fired_classes);
+	close(epoll_fd);
+}
+
+/**
+ *	arm_timer - arm timer
+ *	@when: expiration time (wall clock, 0 disarms the timer)
+ */
+static void arm_timer(time_t when)
+{
+	struct itimerspec its = { .it_value = { .tv_sec = when } };
+
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+		pabort("timerfd_settime");
+}
+
+/**
+ *	event_loop - main event loop
+ *
+ *	Waits for events and dispatches them: memory threshold level
+ *	events (see handle_lowmem()) and memory pressure events (see
+ *	handle_psi_event()) are handled first so they never wait
+ *	behind a task list scan.  The task list is scanned (see
+ *	scan_tasks()) when proxy_shm publishes a new snapshot and when
+ *	the earliest background task exceeds timeout value.  Memory
+ *	threshold levels without events are sampled every
+ *	SAMPLE_INTERVAL seconds.  Without any of these the daemon
+ *	sleeps.  Returns on SIGINT or SIGTERM.
+ */
+static void event_loop(void)
+{
+	struct epoll_event evs[MAX_EPOLL_EVENTS];
+	time_t next_scan, next_sample;
+
+	next_scan = scan_tasks();
+	/* sample right away (0 would disarm the timer) */
+	next_sample = time(NULL);
+
+	while (1) {
+		int scan = 0, psi = 0;
+		time_t t, next;
+		int nr, i;
+
+		next = next_scan;
+		if (sample_lowmem && (!next || next_sample < next))
+			next = next_sample;
+		arm_timer(next);
+
+		nr = epoll_wait(epoll_fd, evs, MAX_EPOLL_EVENTS, -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			pabort("epoll_wait");
 		}
 
-		if (DEBUG)
-			print_bg_tasks();
+		for (i = 0; i < nr; i++) {
+			uint32_t data = evs[i].data.u32;
+			uint64_t expirations;
+			struct signalfd_siginfo si;
 
-		/*
-		 * First scan tasklist_mem task list and:
-		 * - add tasks to corresponding (apps & deamons) cgroups
-		 *   (if cgroups support is enabled)
-		 * - skip tasks that are active or in live_bg_tasks[]
-		 * - skip tasks that are kernel threads (RSS == 0)
-		 * - skip tasks that are in exemption_list[]
-		 * - kill tasks that exceeded timeout value
-		 *
-		 * Then handle tasks exceeding memory limits (if cgroups
-		 * suppport is enabled) or sleep for 1 second (otherwise).
-		 */
-		for (i = 0; i < MAX_NR_TASKS; i++) {
-			struct task_info_shm *tis;
-			struct task_info ti;
-			pid_t pid;
-			time_t t;
-next_task:
-			tis = &tasklist_mem->tasks[i];
-			pid = tis->pid;
-			if (!pid)
+			switch (data) {
+			case EV_PSI:
+				if (evs[i].events & EPOLLERR)
+					pabort("psi trigger");
+				psi = 1;
+				break;
+			case EV_TIMER:
+				if (read(timer_fd, &expirations,
+					 sizeof(expirations)) < 0 &&
+				    errno != EAGAIN)
+					pabort("read timerfd");
+				break;
+			case EV_SIGNAL:
+				if (read(signal_fd, &si, sizeof(si)) < 0)
+					pabort("read signalfd");
+				print_timestamp();
+				printf("got signal %d, exiting\n",
+				       si.ssi_signo);
+				return;
+			case EV_TASKLIST:
+				tasklist_notify_read(notify_fd);
+				scan = 1;
+				break;
+			default:
+				process_event(data / MAX_THRES_LEVELS,
+					      data % MAX_THRES_LEVELS);
+				fired_classes[data / MAX_THRES_LEVELS] = 1;
 				break;
-
-			if (use_cgroups) {
-				/*
-				 * TODO: this is just an approximation and should
-				 *       be accompanied by a list of exemptions..
-				 */
-				if (tis->tty_nr) {
-					add_pid_to_apps_cgroup(pid);
-//					printf("apps pid=%d in daemons: %d\n",
-//					       pid,
-//					       check_pid_in_cgroup(pid, 0));
-//					printf("apps pid=%d in apps: %d\n",
-//					       pid,
-//					       check_pid_in_cgroup(pid, 1));
-				} else {
-					add_pid_to_daemons_cgroup(pid);
-//					printf("daemons pid=%d in daemons: %d\n",
-//					       pid,
-//					       check_pid_in_cgroup(pid, 0));
-//					printf("daemons pid=%d in apps: %d\n",
-//					       pid,
-//					       check_pid_in_cgroup(pid, 1));
-				}
 			}
+		}
 
-			if (tis->activity)
+		for (i = 0; i < nr_classes; i++) {
+			if (!fired_classes[i])
 				continue;
 
-			for (j = 0; j < MAX_LIVE_BG_TASKS; j++) {
-				struct bg_task *bt = &live_bg_tasks[j];
-
-				if (pid == bt->pid) {
-					if (DEBUG) {
-						print_timestamp();
-						printf("skipping live pid %d\n",
-						       pid);
-					}
-					i++;
-					goto next_task;
-				}
+			if (DEBUG) {
+				print_timestamp();
+				printf("got lowmem event (%s)\n",
+				       classes[i].name);
 			}
 
-			t = time(NULL);
-			if (t == -1)
-				pabort("time");
+			fired_classes[i] = 0;
+			invalidate_cgroup_members();
+			handle_lowmem(i);
+		}
 
-			if (t - tis->time <= timeout)
-				continue;
+		if (psi)
+			handle_psi_event();
 
-			if (get_task_info_stat(pid, NULL, &ti))
-				continue;
+		t = time(NULL);
 
-			/* skip kernel threads */
-			if (!ti.rss) {
-				if (DEBUG) {
-					print_timestamp();
-					printf("skipping pid (rss = 0)"
-					       "%d (%s)\n", pid, ti.name);
-				}
-				put_task_info(&ti);
-				continue;
-			}
+		if (sample_lowmem && t >= next_sample) {
+			for (i = 0; i < nr_classes; i++) {
+				if (classes[i].levels[0].efd >= 0)
+					continue;
 
-			for (j = 0; j < exemption_list_len; j++) {
-				if (!strcmp(exemption_list[j], ti.name)) {
-					if (DEBUG) {
-						print_timestamp();
-						printf("[timeout] skipping "
-						       "exempted pid %d (%s)\n",
-						       pid, ti.name);
-					}
-					put_task_info(&ti);
-					i++;
-					goto next_task;
-				}
+				invalidate_cgroup_members();
+				handle_lowmem(i);
 			}
 
-			print_timestamp();
-			printf("[timeout] killing %d timeout %d secs rss %luMiB"
-			       " (%s)\n", pid, (unsigned)(t - tis->time),
-			       ti.rss / 1024 / 1024, ti.name);
-			put_task_info(&ti);
-			kill(pid, SIGKILL);
+			next_sample = t + SAMPLE_INTERVAL;
 		}
-		sem_post(&tasklist_mem->sem);
 
-		if (use_cgroups)
-			poll_lowmem();
-		else
-			sleep(1);
-	};
+		if (scan || (next_scan && t >= next_scan))
+			next_scan = scan_tasks();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	parse_args(argc, argv);
+
+	init_classes();
+	init_config_file();
+	init_thres_levels();
+	if (DEBUG)
+		print_exemptions();
+
+	ret = mlockall(MCL_FUTURE);
+	if (ret)
+		pabort("mlockall");
+
+	if (use_cgroups)
+		init_cgroups(cgroup_version);
+
+	if (use_psi)
+		psi_fd = psi_open(psi_type, psi_stall_ms * 1000,
+				  psi_window_ms * 1000);
+
+	init_tasklist();
+	init_events();
+
+	event_loop();
 
 	free_tasklist();
 
 	free_config_file();
 
+	free_events();
+
+	if (use_psi)
+		psi_close(psi_fd);
+
 	if (use_cgroups)
 		free_cgroups();
+
+	free_classes();
 }
@@ -15,29 +15,143 @@
 #ifndef __TBULMKD_H
 #define __TBULMKD_H
 
+#include "shm.h"
+
+/* maximum number of memory threshold levels per cgroup */
+#define MAX_THRES_LEVELS 4
+
+/* memory threshold level actions */
+enum {
+	THRES_NOTIFY		= 0,	/* just report it */
+	THRES_KILL_STALE	= 1,	/* kill least recently active bg tasks */
+	THRES_KILL_RSS		= 2,	/* kill tasks with the biggest RSS */
+	THRES_KILL_SCORE	= 3,	/* kill tasks chosen by victim_policy */
+};
+
+/* victim scoring policies (see policy.c) */
+enum {
+	POLICY_RSS		= 0,	/* the biggest RSS */
+	POLICY_STALE		= 1,	/* least recently active bg tasks */
+	POLICY_WEIGHTED		= 2,	/* weighted combination */
+};
+
+/* victim memory accounting modes (expected freed memory) */
+enum {
+	ACCOUNT_RSS		= 0,	/* RSS from /proc/$pid/stat */
+	ACCOUNT_PSS		= 1,	/* PSS from smaps_rollup */
+	ACCOUNT_USS		= 2,	/* private memory from smaps_rollup */
+};
+
+/* number of most recent background tasks which are never killed */
+#define MAX_LIVE_BG_TASKS 6
+
+/*
+ * Memory threshold level of a cgroup.  Levels are sorted by @percent
+ * (of the cgroup memory limit), @mem_limit is the resulting threshold
+ * in bytes.  @efd (or -1 if the backend has no event for the level)
+ * is polled for @events.
+ */
 struct mem_threshold {
 	long long mem_limit;
+	int percent;
+	int action;
 	int mfd;
 	int cfd;
 	int efd;
+	int events;	/* poll events efd is signaled with */
 };
 
-extern struct mem_threshold mem_thresholds[2];
+/* task classification rules */
+enum {
+	CLASS_RULE_ANY		= 0,	/* all tasks */
+	CLASS_RULE_TTY		= 1,	/* tasks with TTY */
+	CLASS_RULE_NOTTY	= 2,	/* tasks without TTY */
+	CLASS_RULE_NAME		= 3,	/* tasks with name matching @pattern */
+};
 
-struct pollfd;
+/*
+ * Task class, each class has its own memory cgroup with @percent of
+ * total memory limit and its own memory threshold levels.  Tasks are
+ * put into the first class (in the config file order) whose @rule
+ * matches them.
+ */
+struct mem_class {
+	char *name;
+	int percent;
+	int rule;
+	char *pattern;
+	int nr_levels;
+	struct mem_threshold levels[MAX_THRES_LEVELS];
+	int cur_level;	/* last exceeded level (-1 if none) */
+};
 
-int apps_mem_percent;
-int daemons_mem_percent;
+extern struct mem_class *classes;
+extern int nr_classes;
 
 void free_cgroups(void);
-void init_cgroups(void);
-void add_pid_to_daemons_cgroup(pid_t pid);
-void add_pid_to_apps_cgroup(pid_t pid);
+void init_cgroups(int version);
+void add_pid_to_cgroup(pid_t pid, int idx);
 
-int setup_events(struct pollfd *pollfds, int idx);
+int setup_events(int idx);
 void cleanup_events(int idx);
-void process_event(int idx);
+void process_event(int idx, int level);
 int check_pid_in_cgroup(pid_t pid, int idx);
+void invalidate_cgroup_members(void);
 long long get_mem_usage(int idx);
 
+int psi_open(const char *type, int stall_us, int window_us);
+void psi_close(int fd);
+
+int kill_task(pid_t pid, unsigned long long start_time,
+	      struct task_info *ti, int *pidfdp);
+
+/*
+ * tbulmkd state of a task from the task list snapshot
+ */
+struct task {
+	struct task_info_shm info;
+	int cls;	/* classes[] index, -1 if none */
+	int cg_idx;	/* cgroup the task was added to, -1 if none */
+	int killed;
+	int exempt;	/* task name is in the exemption list */
+	int recent_rank; /* rank among most recent bg tasks, -1 if none */
+	int oom_adj;	/* cached oom_score_adj (if oom_adj_valid) */
+	int oom_adj_valid;
+	ulong mem;	/* cached task_mem() value (if mem_time) */
+	long long mem_time; /* now_ms() time of reading mem */
+	int rss_pos;	/* position in RSS heap, -1 if none */
+	int deadline_pos; /* position in deadline heap, -1 if none */
+	int unkillable;	/* deadline_pos is in the unkillable heap */
+	int stale;	/* task list entry is stale (see scan_tasks()) */
+	unsigned int stamp;
+	int next_free;
+};
+
+extern struct task *task_table;
+
+void update_task_table(struct tasklist_snap *snap);
+struct task *find_task(pid_t pid);
+void mark_task_killed(struct task *t);
+struct task *select_task_mem(int idx, int in_cgroup, ulong *mem);
+ulong task_mem(struct task *t, long long end);
+void set_mem_accounting(const char *name, int budget);
+void mark_task_stale(struct task *t);
+struct task *first_deadline_task(void);
+int live_bg_task(struct task *t);
+pid_t *take_reclassified(int *nr);
+struct task *next_task(struct task *t);
+
+extern int victim_policy;
+extern int mem_accounting;
+extern int accounting_budget;
+
+void set_victim_policy(const char *name);
+void set_policy_weight(const char *name, int value);
+struct task *select_victim(int idx, int policy, ulong *mem);
+
+void add_exemption(const char *pattern);
+int task_exempted(const char *name);
+void print_exemptions(void);
+void free_exemptions(void);
+
 #endif
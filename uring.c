@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#define load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#ifdef __NR_io_uring_setup
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ *	uring_init - set up io_uring instance
+ *	@r: ring
+ *	@entries: number of submission queue entries
+ *
+ *	Creates io_uring instance and maps its rings.  Returns 0 on
+ *	success or errno value on failure (i.e. ENOSYS if the kernel
+ *	has no io_uring support or EPERM if it is disabled).
+ */
+int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	void *sqes;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	r->fd = io_uring_setup(entries, &p);
+	if (r->fd < 0)
+		return errno;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes +
+			  p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		r->cq_ring = mmap(NULL, r->cq_ring_size,
+				  PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd,
+				  IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED)
+			goto err_sq;
+	}
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+		    IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto err_cq;
+
+	r->sqes = sqes;
+	r->sq_entries = p.sq_entries;
+	r->sq_head = r->sq_ring + p.sq_off.head;
+	r->sq_tail = r->sq_ring + p.sq_off.tail;
+	r->sq_mask = r->sq_ring + p.sq_off.ring_mask;
+	r->sq_array = r->sq_ring + p.sq_off.array;
+	r->cq_head = r->cq_ring + p.cq_off.head;
+	r->cq_tail = r->cq_ring + p.cq_off.tail;
+	r->cq_mask = r->cq_ring + p.cq_off.ring_mask;
+	r->cqes = r->cq_ring + p.cq_off.cqes;
+	r->sqe_tail = *r->sq_tail;
+
+	return 0;
+
+err_cq:
+	if (r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+err_sq:
+	munmap(r->sq_ring, r->sq_ring_size);
+err:
+	err = errno;
+	close(r->fd);
+	r->fd = -1;
+
+	return err;
+}
+
+/**
+ *	uring_register_files - register sparse fixed file table
+ *	@r: ring
+ *	@nr: number of slots
+ *
+ *	Registers @nr empty fixed file slots (used by direct opens,
+ *	see io_uring_sqe file_index).  Returns 0 on success or errno
+ *	value on failure.
+ */
+int uring_register_files(struct uring *r, int nr)
+{
+	int *fds;
+	int i, ret;
+
+	fds = malloc(nr * sizeof(*fds));
+	if (!fds)
+		return ENOMEM;
+
+	for (i = 0; i < nr; i++)
+		fds[i] = -1;
+
+	ret = io_uring_register(r->fd, IORING_REGISTER_FILES, fds, nr);
+	free(fds);
+
+	return ret < 0 ? errno : 0;
+}
+
+/**
+ *	uring_submit_wait - submit queued SQEs and wait for completions
+ *	@r: ring
+ *	@nr_wait: number of completions to wait for
+ *
+ *	Submits all SQEs queued by uring_get_sqe() and waits until at
+ *	least @nr_wait completions are available, normally in a single
+ *	system call.  Returns 0 on success or errno value on failure.
+ */
+int uring_submit_wait(struct uring *r, unsigned int nr_wait)
+{
+	store_release(r->sq_tail, r->sqe_tail);
+
+	while (1) {
+		unsigned int ready = load_acquire(r->cq_tail) - *r->cq_head;
+		int ret;
+
+		if (!r->nr_queued && ready >= nr_wait)
+			return 0;
+
+		ret = io_uring_enter(r->fd, r->nr_queued, nr_wait,
+				     nr_wait ? IORING_ENTER_GETEVENTS : 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		/* the kernel didn't take any queued SQE */
+		if (!ret && r->nr_queued)
+			return EAGAIN;
+
+		r->nr_queued -= ret;
+	}
+}
+
+#else /* !__NR_io_uring_setup */
+
+int uring_init(struct uring *r, unsigned int entries)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+
+	return ENOSYS;
+}
+
+int uring_register_files(struct uring *r, int nr)
+{
+	return ENOSYS;
+}
+
+int uring_submit_wait(struct uring *r, unsigned int nr_wait)
+{
+	return ENOSYS;
+}
+
+#endif
+
+/**
+ *	uring_free - tear down io_uring instance
+ *	@r: ring set up by uring_init()
+ */
+void uring_free(struct uring *r)
+{
+	if (r->fd < 0)
+		return;
+
+	munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+	r->fd = -1;
+}
+
+/**
+ *	uring_get_sqe - get a free submission queue entry
+ *	@r: ring
+ *
+ *	Returns a cleared SQE queued for the next uring_submit_wait()
+ *	or NULL if the submission queue is full.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	unsigned int idx;
+
+	if (r->sqe_tail - load_acquire(r->sq_head) >= r->sq_entries)
+		return NULL;
+
+	idx = r->sqe_tail & *r->sq_mask;
+	r->sq_array[idx] = idx;
+	/* published to the kernel by uring_submit_wait() */
+	r->sqe_tail++;
+	r->nr_queued++;
+
+	memset(&r->sqes[idx], 0, sizeof(r->sqes[idx]));
+
+	return &r->sqes[idx];
+}
+
+/**
+ *	uring_peek_cqe - get the next completion
+ *	@r: ring
+ *
+ *	Returns the next completion queue entry (to be released with
+ *	uring_cqe_seen()) or NULL if there is none.
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+
+	if (head == load_acquire(r->cq_tail))
+		return NULL;
+
+	return &r->cqes[head & *r->cq_mask];
+}
+
+/**
+ *	uring_cqe_seen - release completion returned by uring_peek_cqe()
+ *	@r: ring
+ */
+void uring_cqe_seen(struct uring *r)
+{
+	store_release(r->cq_head, *r->cq_head + 1);
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2012 Samsung Electronics Co., Ltd.
+ * Author: Bartlomiej Zolnierkiewicz <b.zolnierkie@samsung.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __TBULMKD_URING_H
+#define __TBULMKD_URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring wrapper using raw system calls (no liburing).
+ * A ring is used by a single thread.
+ */
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int sq_entries;
+	unsigned int sqe_tail; /* SQ tail including queued SQEs */
+	unsigned int nr_queued; /* SQEs not submitted yet */
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+};
+
+int uring_init(struct uring *r, unsigned int entries);
+void uring_free(struct uring *r);
+int uring_register_files(struct uring *r, int nr);
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+int uring_submit_wait(struct uring *r, unsigned int nr_wait);
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+
+#endif